@@ -71,6 +71,7 @@ struct Env {
 	bool env_net_recving;		// Env is blocked receiving
 	void *env_net_dstva;		// VA at which to map received page
 	int env_net_value;		// Data value sent to us
+	int env_net_batch;		// Max packets to receive, or 0 for one
 };
 
 #endif // !JOS_INC_ENV_H
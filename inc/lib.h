@@ -22,6 +22,8 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/prof.h>
+#include <inc/sysstat.h>
 
 #define USED(x)		(void)(x)
 
@@ -59,9 +61,19 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
-int	sys_tx_data(const char *data, uint8_t nbytes);
+int	sys_ipc_recv_until(void *rcv_pg, unsigned int msec);
+int	sys_tx_data(const char *data, size_t nbytes);
 int	sys_rx_data(void *data);
 unsigned int sys_time_msec(void);
+int	sys_sleep_until(unsigned int msec);
+int	sys_prof(int cmd, struct ProfSample *buf, size_t n);
+int	sys_stats(envid_t env, struct SysStat *buf, bool reset);
+int	sys_tx_batch(const struct jif_pkt *pkts, int n);
+int	sys_rx_batch(void *va, int n);
+int	sys_tx_wait(void);
+int	sys_rx_bind(int q);
+int	sys_nic_map(void *va, uint32_t value);
+int	sys_nic_kick(int rdt, int tdt);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t __attribute__((always_inline))
@@ -79,6 +91,8 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+		       unsigned int deadline);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
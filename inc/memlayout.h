@@ -114,6 +114,8 @@
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
 #define UENVS		(UPAGES - PTSIZE)
+// Per-CPU kernel trace buffers, in the upper half of the envs slot
+#define UTRACE		(UENVS + PTSIZE / 2)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
@@ -185,7 +187,17 @@ struct PageInfo {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// Buddy allocator state, only meaningful while the page is free.
+	uint8_t pp_order;		// Order of the free block this page heads
+	uint8_t pp_flags;		// PP_* below
+	struct PageInfo *pp_prev;	// Previous block on the same free list
 };
 
+// Values of pp_flags
+#define PP_BUDDY	0x1	// Heads a free block on a buddy free list
+#define PP_PCP		0x2	// Sits in a per-CPU free page cache
+#define PP_ZERO		0x4	// Sits in the pre-zeroed page pool
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
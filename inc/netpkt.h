@@ -0,0 +1,61 @@
+#ifndef JOS_INC_NETPKT_H
+#define JOS_INC_NETPKT_H
+
+#include <inc/types.h>
+
+// Packets as they travel between the e1000 driver, ns_input/ns_output
+// and the network server.
+
+// One packet; the e1000 driver receives straight into this layout.
+struct jif_pkt {
+	int jp_len;
+	uint16_t jp_flags;	// JIF_CSUM_*, JIF_TSO
+	uint16_t jp_mss;	// JIF_TSO: TCP payload bytes per segment
+	char jp_data[0];
+};
+
+// jp_flags: on output, the checksums the card should fill in; on input,
+// the ones the card checked and found good.
+#define JIF_CSUM_IP	0x1	// IPv4 header checksum
+#define JIF_CSUM_L4	0x2	// TCP or UDP checksum, over the pseudo header
+				// sum that the sender left in the field
+#define JIF_TSO		0x4	// output only: a TCP/IPv4 frame of up to
+				// JIF_TSO_MAX bytes, which the card cuts into
+				// segments of jp_mss payload bytes each; it
+				// needs both checksum flags, and the pseudo
+				// header sum in the TCP header leaves out the
+				// length, which differs from segment to segment
+
+#define JIF_TSO_MAX	(64 * 1024)
+
+// The largest IP packet the interface sends or expects, and so the
+// largest frame without JIF_TSO (plus the Ethernet header; the card
+// adds the CRC).  "make MTU=9000" builds for jumbo frames, which only
+// pay off on a network that carries them, such as a host bridge set
+// up through QEMUEXTRA; QEMU's user-mode network stays at 1500.
+#ifndef JIF_MTU
+#define JIF_MTU		1500
+#endif
+#define JIF_FRAME_MAX	(JIF_MTU + 14)
+
+// Pages a received packet takes: one that does not fit in the page
+// after its header runs on into the pages that follow.
+#define JIF_PKT_PAGES(pkt) \
+	(ROUNDUP(sizeof(struct jif_pkt) + (pkt)->jp_len, PGSIZE) / PGSIZE)
+
+// Several packets sharing a page: jb_npkts struct jif_pkt records, the
+// first at jb_data and each of the others at the first 4-byte boundary
+// after the data of the one before.  Records may run on into the pages
+// that follow, up to JIF_BATCH_PAGES in all, which leaves room for one
+// JIF_TSO_MAX frame.
+struct jif_batch {
+	int jb_npkts;
+	char jb_data[0];
+};
+
+#define JIF_BATCH_PAGES	17
+
+#define JIF_PKT_NEXT(pkt) \
+	((struct jif_pkt *) ROUNDUP((uintptr_t) (pkt)->jp_data + (pkt)->jp_len, 4))
+
+#endif	// !JOS_INC_NETPKT_H
@@ -0,0 +1,70 @@
+#ifndef JOS_INC_NICRING_H
+#define JOS_INC_NICRING_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// The e1000's rings as the network server sees them once it has taken
+// the card over with sys_nic_map.  The kernel maps NIC_MAP_PAGES pages:
+// the descriptor rings, read-only, then a control page and the packet
+// buffers, both writable.  The server fills and empties the buffers
+// itself and moves the ring tails with sys_nic_kick, which writes the
+// descriptors it hands the card, so the card never sees an address the
+// kernel did not put there.  The card's interrupts only wake the server
+// (see sys_nic_map).
+
+#define NIC_RX_SLOTS	128
+#define NIC_TX_SLOTS	64
+#define NIC_BUF_SZ	2048	// so frames are at most 1514 bytes
+
+// The card's legacy descriptors
+struct nic_rx_desc {
+	uint64_t addr;
+	uint16_t length;
+	uint16_t csum;
+	uint8_t status;		// NIC_RXD_STAT_*
+	uint8_t errors;		// NIC_RXD_ERR_*
+	uint16_t special;
+};
+
+struct nic_tx_desc {
+	uint64_t addr;
+	uint16_t length;
+	uint8_t cso;
+	uint8_t cmd;
+	uint8_t status;		// NIC_TXD_STAT_*
+	uint8_t css;
+	uint16_t special;
+};
+
+#define NIC_RXD_STAT_DD		0x01	// the card is done with it
+#define NIC_RXD_STAT_EOP	0x02
+#define NIC_RXD_STAT_IXSM	0x04	// checksums not looked at
+#define NIC_RXD_STAT_TCPCS	0x20	// TCP or UDP checksum checked
+#define NIC_RXD_STAT_IPCS	0x40	// IPv4 header checksum checked
+#define NIC_RXD_ERR_TCPE	0x20	// and found bad
+#define NIC_RXD_ERR_IPE		0x40
+
+#define NIC_TXD_STAT_DD		0x01	// the card has sent it
+
+struct nic_rings {
+	struct nic_rx_desc rx[NIC_RX_SLOTS];
+	struct nic_tx_desc tx[NIC_TX_SLOTS];
+};
+
+// What sys_nic_kick reads besides the tails: the length of the frame
+// in each tx buffer it hands the card
+struct nic_ctl {
+	uint16_t tx_len[NIC_TX_SLOTS];
+};
+
+#define NIC_BUF_PAGES	((NIC_RX_SLOTS + NIC_TX_SLOTS) * NIC_BUF_SZ / PGSIZE)
+#define NIC_MAP_PAGES	(2 + NIC_BUF_PAGES)
+
+// Where things are in the pages mapped at 'va'
+#define NIC_RINGS(va)		((struct nic_rings *) (va))
+#define NIC_CTL(va)		((struct nic_ctl *) ((char *) (va) + PGSIZE))
+#define NIC_RX_BUF(va, i)	((char *) (va) + 2 * PGSIZE + (i) * NIC_BUF_SZ)
+#define NIC_TX_BUF(va, i)	NIC_RX_BUF(va, NIC_RX_SLOTS + (i))
+
+#endif	// !JOS_INC_NICRING_H
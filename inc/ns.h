@@ -5,13 +5,9 @@
 
 #include <inc/types.h>
 #include <inc/mmu.h>
+#include <inc/netpkt.h>
 #include <lwip/sockets.h>
 
-struct jif_pkt {
-	int jp_len;
-	char jp_data[0];
-};
-
 // Definitions for requests from clients to network server
 enum {
 	// The following messages pass a page containing an Nsipc.
@@ -35,8 +31,31 @@ enum {
 
 	// The following message passes no page
 	NSREQ_TIMER,
+
+	// Like NSREQ_INPUT and NSREQ_OUTPUT, but the page holds a
+	// struct jif_batch
+	NSREQ_INPUT_BATCH,
+	NSREQ_OUTPUT_BATCH,
+
+	// From the kernel, for an interrupt of the card when the network
+	// server drives it itself (see inc/nicring.h); passes no page
+	NSREQ_NIC,
 };
 
+// An NSREQ_OUTPUT_BATCH batch that runs past its first page: before it
+// sends the first page, the network server maps the others into the
+// output environment itself, right after where the first one lands.
+// The output environment receives batches alternately at NSOUTPUT_VA and
+// NSOUTPUT_VA + JIF_BATCH_PAGES * PGSIZE, so the server never remaps
+// pages that the output environment may still be reading.
+#define NSOUTPUT_VA	0x20000000
+
+// An NSREQ_INPUT packet too long for its page (see JIF_PKT_PAGES) goes
+// on in the input environment's pages from NSINPUT_VA + PGSIZE on.  The
+// network server maps them in after the first page, at the same place
+// in its own address space, and replies once it is done with them.
+#define NSINPUT_VA	0x21000000
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
@@ -98,6 +117,7 @@ union Nsipc {
 	} socket;
 
 	struct jif_pkt pkt;
+	struct jif_batch batch;
 
 	// Ensure Nsipc is one page
 	char _pad[PGSIZE];
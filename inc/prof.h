@@ -0,0 +1,29 @@
+#ifndef JOS_INC_PROF_H
+#define JOS_INC_PROF_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// Commands for sys_prof()
+enum {
+	PROF_START = 0,		// Discard old samples and start sampling
+	PROF_STOP,		// Stop sampling; samples stay readable
+	PROF_READ,		// Move up to 'n' samples into 'buf'
+};
+
+// Number of program counters kept per sample
+#define PROF_DEPTH	8
+
+// One sample of the timer-driven profiler.  ps_pc[0] is the
+// interrupted eip, the rest are return addresses found by following
+// the %ebp chain.
+struct ProfSample {
+	envid_t ps_envid;		// curenv, or 0 if the CPU was idle
+	uint8_t ps_cpu;			// CPU that took the sample
+	uint8_t ps_user;		// Sampled in user mode
+	uint8_t ps_envtype;		// enum EnvType of ps_envid
+	uint8_t ps_depth;		// Valid entries in ps_pc
+	uintptr_t ps_pc[PROF_DEPTH];
+};
+
+#endif /* !JOS_INC_PROF_H */
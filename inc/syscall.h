@@ -20,6 +20,15 @@ enum {
 	SYS_time_msec,
 	SYS_tx_data,
 	SYS_rx_data,
+	SYS_sleep_until,
+	SYS_prof,
+	SYS_stats,
+	SYS_tx_batch,
+	SYS_rx_batch,
+	SYS_tx_wait,
+	SYS_rx_bind,
+	SYS_nic_map,
+	SYS_nic_kick,
 	NSYSCALLS
 };
 
@@ -0,0 +1,25 @@
+#ifndef JOS_INC_SYSSTAT_H
+#define JOS_INC_SYSSTAT_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// Statistics of one system call, as returned by sys_stats().
+// Latency is the time, in TSC cycles, from the system call's entry
+// into the kernel until the kernel next returns to user mode or goes
+// idle; a blocked environment's waiting time does not count.
+#define SYSSTAT_NBUCKETS	32
+
+struct SysStat {
+	uint32_t ss_count;		// Number of calls
+	uint32_t ss_pad;
+	uint64_t ss_cycles;		// Sum of latencies
+	// ss_hist[i] counts calls that took [2^i, 2^(i+1)) cycles; the
+	// last bucket also holds everything longer
+	uint32_t ss_hist[SYSSTAT_NBUCKETS];
+};
+
+// Pass as the envid to sys_stats() for the system-wide statistics
+#define SYSSTAT_GLOBAL	((envid_t) -1)
+
+#endif /* !JOS_INC_SYSSTAT_H */
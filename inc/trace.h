@@ -0,0 +1,46 @@
+#ifndef JOS_INC_TRACE_H
+#define JOS_INC_TRACE_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/env.h>
+
+// Kernel event trace.  Each CPU appends records to its own ring,
+// which every environment can read at UTRACE + cpu * TRACE_BUFSIZE.
+// A ring is mapped only for CPUs that exist.
+
+enum {
+	TRACE_NONE = 0,
+	TRACE_ENV_RUN,		// arg0: env being run (tr_envid: previous)
+	TRACE_TRAP,		// arg0: trapno, arg1: syscall number or eip
+	TRACE_IPC_SEND,		// arg0: target env, arg1: value
+	TRACE_IPC_RECV,		// arg0: dstva, arg1: deadline
+	TRACE_RX_PKT,		// arg0: receiving env, arg1: length or error
+	TRACE_TX_PKT,		// arg0: length, arg1: descriptor index
+	TRACE_PGFLT,		// arg0: fault va, arg1: eip
+	TRACE_NIC_IRQ,		// arg0: e1000 ICR, arg1: receiving env or 0
+	NTRACE
+};
+
+struct TraceRec {
+	uint64_t tr_tsc;	// rdtsc at the trace point
+	uint16_t tr_event;	// TRACE_*
+	uint16_t tr_pad;
+	envid_t tr_envid;	// curenv, or 0
+	uint32_t tr_arg[2];	// Event-specific, see above
+};
+
+#define TRACE_NRECS	2048		// Power of two
+#define TRACE_BUFSIZE	(16 * PGSIZE)	// Room for a struct TraceBuf
+
+// A reader copies the records it has not seen yet, then reads tb_head
+// again: any record more than TRACE_NRECS behind the new head may have
+// been overwritten during the copy.
+struct TraceBuf {
+	volatile uint32_t tb_head;	// Records ever written; next one goes
+					// at tb_recs[tb_head % TRACE_NRECS]
+	uint32_t tb_cpu;		// CPU writing this ring
+	struct TraceRec tb_recs[TRACE_NRECS];
+};
+
+#endif /* !JOS_INC_TRACE_H */
@@ -23,6 +23,13 @@ struct CpuInfo {
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	struct PageInfo *cpu_pcp;       // Cache of free pages (see pmap.c)
+	int cpu_npcp;                   // Number of pages in cpu_pcp
+	pde_t *cpu_pgdir;               // Page directory loaded in %cr3
+	volatile bool cpu_tlb_stale;    // cpu_pgdir changed behind our back
+	volatile bool cpu_in_kernel;    // Entered the kernel from user mode
+	struct Env *cpu_fpu_owner;      // Env whose state is in the FPU (see fpu.c)
+	bool cpu_fpu_live;              // FPU state newer than its save area
 };
 
 // Initialized in mpconfig.c
@@ -42,5 +49,6 @@ void lapic_init(void);
 void lapic_startap(uint8_t apicid, uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
+void lapic_ipi_cpu(int apicid, int vector);
 
 #endif
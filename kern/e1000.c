@@ -2,8 +2,11 @@
 #include <inc/string.h>
 #include <kern/pmap.h>
 #include <kern/env.h>
+#include <kern/cpu.h>
 #include <kern/picirq.h>
 #include <kern/sched.h>
+#include <kern/trace.h>
+#include <kern/timer.h>
 
 // TODO: try to separate tx/rx code at the final stage;
 
@@ -13,13 +16,52 @@ volatile uint32_t *e1000_mmio_beg;
 
 // global definition of tx_desc list for 64 entries
 struct tx_desc tx_desc_lst[TX_DESC_SZ];
-// 64 entries, each 1518 bytes long
-uint8_t tx_pkt_buffer_lst[TX_DESC_SZ][ETH_PKT_SZ]
+// 64 entries, each long enough for a frame that is copied
+uint8_t tx_pkt_buffer_lst[TX_DESC_SZ][TX_COPYBREAK]
 __attribute__ ((aligned(PGSIZE)));
+// user page a tx descriptor sends from, if it was not copied; the
+// reference keeps the page from being reused until the card is done
+static struct PageInfo *tx_page_lst[TX_DESC_SZ];
+// oldest descriptor the card may still own; the driver fills the ones
+// from TDT up to just before it, so one slot always stays empty
+static int tx_idx_clean;
+// checksum context the card was last given; a frame that needs the same
+// one goes without a context descriptor of its own
+static struct {
+	bool valid;
+	uint8_t ipcss, ipcso, tucss, tucso;
+	uint32_t tucmd;
+} tx_ctx;
+// envs blocked in sys_tx_wait until the ring has room, linked through
+// tx_wait_link (indexed by ENVX); the next TXDW interrupt wakes them all
+static struct Env *tx_wait_head;
+static struct Env *tx_wait_link[NENV];
 
 struct rx_desc rx_desc_lst[RX_NUM_OF_DESC];
-uint8_t rx_pkt_buffer_lst[RX_NUM_OF_DESC][RX_DESC_SZ]
-__attribute__ ((aligned(PGSIZE)));
+// page behind each rx descriptor; rx_harvest() moves it to a receive
+// queue and puts a fresh one in its place; they are zeroed, so the
+// receiver sees nothing of the page's previous owner around the packet
+static struct PageInfo *rx_page_lst[RX_NUM_OF_DESC];
+
+// software receive queues: the 82540EM has a single rx ring, so the
+// driver does the card's RSS work itself; it hashes each frame's flow
+// as RSS does, looks the queue up in rx_reta and moves the frame's page
+// there, for the input env bound to that queue with rx_bind(); a flow
+// always lands in the same queue, so its frames stay in order
+static struct rx_queue {
+	struct PageInfo *pages[RX_QUEUE_LEN];
+	int head, len;
+	struct Env *owner;
+} rx_queues[RX_NUM_OF_QUEUES];
+static int rx_nqueues;
+static uint8_t rx_reta[RX_RETA_SZ];
+// queue each env receives from (indexed by ENVX); envs that never
+// bound one share queue 0, which also gets every frame that is not
+// IPv4, such as ARP
+static uint8_t rx_env_queue[NENV];
+
+// set while the network server drives the card itself; see nic_map()
+static struct Env *nic_owner;
 
 // hard coded mac address for qemu; will be stored in RAL[0] and RAH[0]
 // @note: info about those registers was somehow hidden for me in
@@ -101,21 +143,32 @@ static void init_rx(void)
 	// address valid
 	e1000_mmio_beg[E1000_RAH0] |= E1000_RAH_AV;
 
+	// interrupt moderation; see RX_DELAY
+	e1000_mmio_beg[E1000_RDTR] = RX_DELAY;
+	e1000_mmio_beg[E1000_RADV] = RX_ABS_DELAY;
+	e1000_mmio_beg[E1000_ITR] = 1000000000 / (NIC_IRQ_RATE * 256);
 	// interrupt mask set
 	e1000_mmio_beg[E1000_IMS] |= E1000_IMS_RXT0;
 	/* e1000_mmio_beg[E1000_IMS] |= E1000_IMS_RXO; */
 	/* e1000_mmio_beg[E1000_IMS] |= E1000_IMS_RXSEQ; */
-	// long packet enable
-	e1000_mmio_beg[E1000_RCTL] &= ~E1000_RCTL_LPE;
+	// long packet enable, for frames over 1522 bytes; rx_harvest()
+	// puts those back together from the descriptors they fill
+	if (ETH_PKT_SZ > 1522)
+		e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_LPE;
+	else
+		e1000_mmio_beg[E1000_RCTL] &= ~E1000_RCTL_LPE;
 	// loppback mode
 	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_LBM_NO;
 	// broadcast accept mode
 	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_BAM;
-	// buffer size extended
-	e1000_mmio_beg[E1000_RCTL] &= ~E1000_RCTL_BSEX;
-	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_SZ_4096;
+	// 2048-byte buffers (BSEX clear), which fit in the rx page after
+	// the jp_len word; SZ_4096 without BSEX would mean 256 bytes
+	e1000_mmio_beg[E1000_RCTL] &= ~(E1000_RCTL_BSEX | E1000_RCTL_SZ_MASK);
+	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_SZ_2048;
 	// strip ethernet crc
 	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_SECRC;
+	// check IPv4, TCP and UDP checksums; see rx_csum_flags()
+	e1000_mmio_beg[E1000_RXCSUM] = E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL;
 	// receiver enable
 	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_EN;
 
@@ -123,8 +176,15 @@ static void init_rx(void)
 	/* for (i = 0; i < 128; i++) */
 	/* 	e1000_mmio_beg[E1000_MTA + (i * 4)] = 0; */
 
-	for (i = 0; i < RX_NUM_OF_DESC; i++)
-		rx_desc_lst[i].addr = PADDR(rx_pkt_buffer_lst[i]);
+	// a queue per CPU, so that each has one to process it
+	rx_nqueues = MIN(RX_NUM_OF_QUEUES, ncpu);
+
+	for (i = 0; i < RX_NUM_OF_DESC; i++) {
+		if (!(rx_page_lst[i] = page_alloc(ALLOC_ZERO)))
+			panic("init_rx: out of memory for rx buffers");
+		rx_page_lst[i]->pp_ref++;
+		rx_desc_lst[i].addr = page2pa(rx_page_lst[i]) + RX_PKT_HDR;
+	}
 }
 
 int e1000_attach(struct pci_func *f)
@@ -140,97 +200,976 @@ int e1000_attach(struct pci_func *f)
 	return 0;
 }
 
-static void clear_nic_irqs(void)
+// set while rx interrupts are masked: the receiver is draining the
+// ring with sys_rx_data and sys_rx_batch, NAPI-style, and will turn
+// them back on once it finds the ring empty; under a flood, it keeps
+// polling and the card stops interrupting altogether;
+static bool rx_polling;
+
+static void rx_irq_disable(void)
 {
-	e1000_mmio_beg[E1000_ICR] |= E1000_IMS_RXT0;
-	// watch out for calling irq_eoi() before clearing rx irq in reg
-	lapic_eoi();
-	irq_eoi();
+	e1000_mmio_beg[E1000_IMC] = E1000_IMS_RXT0;
+	rx_polling = 1;
+}
+
+static void rx_irq_enable(void)
+{
+	rx_polling = 0;
+	// drop the cause left over from packets that were polled; writing
+	// a 1 clears just that bit, and leaves a pending TXDW alone
+	e1000_mmio_beg[E1000_ICR] = E1000_ICR_RXT0;
+	e1000_mmio_beg[E1000_IMS] = E1000_IMS_RXT0;
 }
 
+static void tx_wake(void);
+static void rx_poll(void);
+static void nic_notify(void);
+static void nic_release(void);
+
 void nic_irq_handler(void)
 {
-	struct Env *recver;
+	uint32_t icr;
 
-	// if currently there is no environment waiting for packets,
-	// silently clear the irq and continue JOS's working;
-	if ((recver = env_net_recver()) == NULL) {
-		clear_nic_irqs();
+	// reading ICR clears it; mask rx interrupts until the ring is
+	// drained, and only then acknowledge the irq;
+	icr = e1000_mmio_beg[E1000_ICR];
+	if ((icr & E1000_ICR_RXT0) && !nic_owner)
+		rx_irq_disable();
+	lapic_eoi();
+	irq_eoi();
+
+	TRACE(TRACE_NIC_IRQ, icr, 0);
+	// the network server drives the card itself; just wake it
+	if (nic_owner) {
+		nic_notify();
 		return;
 	}
-	// found some env that is receiving packet -- let's check
-	// whether there is some address for receiving packet and then
-	// call the receive function;
-	if (recver->env_net_dstva)
-		rx_pkt(recver);
+	// the card has sent frames, so blocked senders can try again
+	if (icr & E1000_ICR_TXDW)
+		tx_wake();
+	// sort the new frames into their queues and hand them to the
+	// input envs waiting there; the others find theirs on their next
+	// sys_rx_data or sys_rx_batch
+	if (icr & E1000_ICR_RXT0)
+		rx_poll();
 }
 
 // points to the packet ready for processing
 static int rx_idx_ready;
 
-int rx_pkt(struct Env *e)
+// the checksums the card verified in the frame of rx descriptor 'd',
+// as JIF_CSUM_* flags
+static int rx_csum_flags(struct rx_desc *d)
+{
+	int flags = 0;
+
+	// IXSM: the card did not look at the checksums at all
+	if (d->status.bits.IXSM)
+		return 0;
+	if (d->status.bits.IPCS && !d->errors.bits.IPE)
+		flags |= JIF_CSUM_IP;
+	if (d->status.bits.TCPCS && !d->errors.bits.TCPE)
+		flags |= JIF_CSUM_L4;
+	return flags;
+}
+
+// the key RSS hashes with, the one Microsoft specifies and most drivers
+// default to
+static const uint8_t rx_rss_key[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+// Toeplitz hash of the 'n' bytes at 'in': for every set bit of the
+// input, xor in the 32 bits of the key that start at that bit
+static uint32_t rx_rss_hash(const uint8_t *in, int n)
+{
+	uint32_t hash = 0, window;
+	int i, bit;
+
+	window = (rx_rss_key[0] << 24) | (rx_rss_key[1] << 16) |
+		 (rx_rss_key[2] << 8) | rx_rss_key[3];
+	for (i = 0; i < n; i++)
+		for (bit = 7; bit >= 0; bit--) {
+			if (in[i] & (1 << bit))
+				hash ^= window;
+			window <<= 1;
+			if (rx_rss_key[i + 4] & (1 << bit))
+				window |= 1;
+		}
+	return hash;
+}
+
+// the queue for the 'len'-byte frame at 'frame': IPv4 frames hash on
+// their addresses, and TCP and UDP ones that are not fragments on their
+// ports too, as RSS does; anything else goes to queue 0
+static int rx_queue_of(const uint8_t *frame, int len)
+{
+	const uint8_t *ip = frame + 14;
+	uint8_t tuple[12];
+	int hlen, n;
+
+	if (len < 14 + 20 || frame[12] != 0x08 || frame[13] != 0x00 ||
+	    (ip[0] >> 4) != 4)
+		return 0;
+	hlen = (ip[0] & 0xf) * 4;
+	// source and destination address
+	memcpy(tuple, ip + 12, 8);
+	n = 8;
+	// then the ports, unless a fragment may lack them
+	if ((ip[9] == 6 || ip[9] == 17) && !(ip[6] & 0x3f) && !ip[7] &&
+	    len >= 14 + hlen + 4) {
+		memcpy(tuple + 8, ip + hlen, 4);
+		n = 12;
+	}
+	return rx_reta[rx_rss_hash(tuple, n) % RX_RETA_SZ];
+}
+
+// make rx_reta spread flows evenly over queue 0 and the queues that
+// have an input env bound to them
+static void rx_reta_fill(void)
+{
+	int queues[RX_NUM_OF_QUEUES];
+	int i, n = 0;
+
+	queues[n++] = 0;
+	for (i = 1; i < rx_nqueues; i++)
+		if (rx_queues[i].owner)
+			queues[n++] = i;
+	for (i = 0; i < RX_RETA_SZ; i++)
+		rx_reta[i] = queues[i % n];
+}
+
+// copy 'n' bytes from 'src' to offset 'off' of the packet whose pages
+// are 'pages'
+static void rx_copy(struct PageInfo **pages, size_t off, const char *src,
+		    size_t n)
+{
+	size_t len;
+
+	for (; n > 0; off += len, src += len, n -= len) {
+		len = MIN(n, PGSIZE - off % PGSIZE);
+		memcpy((char *) page2kva(pages[off / PGSIZE]) + off % PGSIZE,
+		       src, len);
+	}
+}
+
+// take the frame that fills the 'ndesc' descriptors from rx_idx_ready
+// on, 'len' bytes in all, out of the ring; the first page becomes its
+// struct jif_pkt and goes to its queue with a fresh one left in its
+// place, and a frame longer than that page gets more pages, into which
+// the other descriptors' buffers are copied; a frame whose queue is
+// full is dropped; returns -E_NO_MEM, leaving the frame in the ring,
+// if there are no pages for it
+static int rx_take(int ndesc, int len)
+{
+	struct PageInfo *pages[RX_PKT_PAGES_MAX + 1];
+	struct rx_desc *last;
+	struct rx_queue *rq;
+	struct jif_pkt *pkt;
+	char *buf;
+	int npages, i, k;
+
+	last = &rx_desc_lst[(rx_idx_ready + ndesc - 1) % RX_NUM_OF_DESC];
+	pkt = page2kva(rx_page_lst[rx_idx_ready]);
+	pkt->jp_len = len;
+	pkt->jp_flags = rx_csum_flags(last);
+	pkt->jp_mss = 0;
+	npages = JIF_PKT_PAGES(pkt);
+	// the headers the hash needs are all in the first buffer
+	rq = &rx_queues[rx_queue_of((uint8_t *) pkt->jp_data,
+				    MIN(len, RX_BUF_SZ))];
+
+	if (npages > RX_PKT_PAGES_MAX || rq->len + npages > RX_QUEUE_LEN) {
+		// drop it, keeping the pages zeroed for whoever gets them
+		for (k = 0; k < ndesc; k++) {
+			i = (rx_idx_ready + k) % RX_NUM_OF_DESC;
+			memset(page2kva(rx_page_lst[i]), 0,
+			       RX_PKT_HDR + rx_desc_lst[i].length);
+		}
+		return 0;
+	}
+
+	// the first page for the queue, and a fresh one for the card
+	pages[0] = rx_page_lst[rx_idx_ready];
+	for (k = 0; k < npages; k++)
+		if (!(pages[k ? k : npages] = page_alloc(ALLOC_ZERO))) {
+			while (--k >= 0)
+				page_free(pages[k ? k : npages]);
+			return -E_NO_MEM;
+		}
+	pages[npages]->pp_ref++;
+	rx_page_lst[rx_idx_ready] = pages[npages];
+	rx_desc_lst[rx_idx_ready].addr = page2pa(pages[npages]) + RX_PKT_HDR;
+
+	// the rest of the frame follows the first buffer; those buffers
+	// stay with the card
+	for (k = 1; k < ndesc; k++) {
+		i = (rx_idx_ready + k) % RX_NUM_OF_DESC;
+		buf = (char *) page2kva(rx_page_lst[i]) + RX_PKT_HDR;
+		rx_copy(pages, RX_PKT_HDR + k * RX_BUF_SZ, buf,
+			rx_desc_lst[i].length);
+		memset(buf, 0, rx_desc_lst[i].length);
+	}
+
+	// the queue takes over the driver's reference to the first page
+	for (k = 0; k < npages; k++) {
+		if (k)
+			pages[k]->pp_ref++;
+		rq->pages[(rq->head + rq->len++) % RX_QUEUE_LEN] = pages[k];
+	}
+	return 0;
+}
+
+// move every frame the card has filled into its queue; stops early when
+// out of pages, which leaves the rest in the ring until receivers hand
+// theirs back, and at a frame the card is still writing;
+static void rx_harvest(void)
 {
-	int idx_next;
-	int ret;
-
-	// check the DD bit in the next descriptor
-	if (!rx_desc_lst[rx_idx_ready].status.bits.DD)
-		return -E_E1000_NOT_RX;
-
-	// note: for now, ignore the status.EOP, since we do not
-	//       accept jumbo frames (RCTL.LPE = 0);
-	ret = rx_desc_lst[rx_idx_ready].length;
-	// clear status field
-	rx_desc_lst[rx_idx_ready].status.raw = 0;
-
-	// actual copy of packet surrounded with lcr3 calls in order to
-	// have access to the dst page and then going back to curenv's page dir;
-	lcr3(PADDR(e->env_pgdir));
-	memmove(e->env_net_dstva, rx_pkt_buffer_lst[rx_idx_ready], ret);
-	lcr3(PADDR(curenv->env_pgdir));
-
-	// make rx_idx_ready point to next descriptor in rx ring
-	rx_idx_ready = (rx_idx_ready + 1) % RX_NUM_OF_DESC;
-	//
-	// compute the next index value that will be stored in RDT register;
-	idx_next = (e1000_mmio_beg[E1000_RDT] + 1) % RX_NUM_OF_DESC;
-	e1000_mmio_beg[E1000_RDT] = idx_next;
-
-	// mark env as runnable, not receiving packets and store number of
-	// copied bytes in eax register;
+	struct rx_desc *desc;
+	int nseen = 0, ndesc, len, k;
+
+	while (rx_desc_lst[rx_idx_ready].status.bits.DD) {
+		// a long frame fills descriptors up to the one with EOP set
+		for (ndesc = 1, len = 0; ; ndesc++) {
+			desc = &rx_desc_lst[(rx_idx_ready + ndesc - 1)
+					    % RX_NUM_OF_DESC];
+			if (!desc->status.bits.DD)
+				goto out;
+			len += desc->length;
+			if (desc->status.bits.EOP)
+				break;
+		}
+		if (rx_take(ndesc, len) < 0)
+			break;
+		for (k = 0; k < ndesc; k++) {
+			desc = &rx_desc_lst[rx_idx_ready];
+			// clear status fields
+			desc->status.raw = 0;
+			desc->errors.raw = 0;
+			// make rx_idx_ready point to next descriptor in rx ring
+			rx_idx_ready = (rx_idx_ready + 1) % RX_NUM_OF_DESC;
+		}
+		nseen += ndesc;
+	}
+
+out:
+	// give all the harvested descriptors back to the card with a
+	// single RDT write;
+	if (nseen)
+		e1000_mmio_beg[E1000_RDT] =
+			(e1000_mmio_beg[E1000_RDT] + nseen) % RX_NUM_OF_DESC;
+}
+
+// the env blocked waiting for packets from queue 'q', if any; only the
+// owner of a bound queue receives from it
+static struct Env *rx_recver(int q)
+{
+	int i;
+
+	if (rx_queues[q].owner)
+		return rx_queues[q].owner->env_net_recving ?
+			rx_queues[q].owner : NULL;
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_net_recving && rx_env_queue[i] == q)
+			return &envs[i];
+	return NULL;
+}
+
+// deliver packets from queue 'rq' to env 'e', which waits in
+// sys_rx_data (one page; returns the packet length) or in sys_rx_batch
+// (up to env_net_batch pages; returns the number of packets); the i-th
+// page goes to env_net_dstva + i * PGSIZE, and each packet takes
+// JIF_PKT_PAGES of them; one that would not fit even into all the pages
+// is dropped;
+static int rx_deliver(struct Env *e, struct rx_queue *rq)
+{
+	int max = e->env_net_batch ? e->env_net_batch : 1;
+	int ndone = 0, npages = 0, len = 0;
+	struct PageInfo *pp;
+	int ret, r = 0, i, n, plen;
+
+	while (rq->len) {
+		// look at the next packet, but only report its length
+		// once it has been mapped
+		pp = rq->pages[rq->head];
+		plen = ((struct jif_pkt *) page2kva(pp))->jp_len;
+		n = JIF_PKT_PAGES((struct jif_pkt *) page2kva(pp));
+		if (npages + n > max && npages)
+			break;
+		// the pages already hold the packet as a struct jif_pkt;
+		// map them into the receiver, no copying; if that fails,
+		// the packet is dropped and the batch ends there;
+		// otherwise the receiver holds the only reference
+		for (i = 0; i < n; i++) {
+			pp = rq->pages[rq->head];
+			rq->head = (rq->head + 1) % RX_QUEUE_LEN;
+			rq->len--;
+			if (r >= 0 && n <= max)
+				r = page_insert(e->env_pgdir, pp,
+						(char *) e->env_net_dstva +
+						(npages + i) * PGSIZE,
+						PTE_P | PTE_U | PTE_W);
+			page_decref(pp);
+		}
+		if (r < 0)
+			break;
+		if (n > max)
+			continue;
+		npages += n;
+		ndone++;
+		len = plen;
+		TRACE(TRACE_RX_PKT, e->env_id, len);
+	}
+
+	if (!ndone)
+		ret = r < 0 ? r : -E_E1000_NOT_RX;
+	else
+		ret = e->env_net_batch ? ndone : len;
+
+	// mark env as runnable, not receiving packets and store the
+	// result in eax register;
 	e->env_status = ENV_RUNNABLE;
 	e->env_net_recving = 0;
 	e->env_net_value = ret;
 	e->env_tf.tf_regs.reg_eax = ret;
 
-	clear_nic_irqs();
-
 	return ret;
 }
 
-int tx_pkt(const char *data, uint8_t nbytes)
+// harvest the ring, and wake the envs blocked on queues that now have
+// packets
+static void rx_poll(void)
 {
-	int idx, next;
+	struct Env *recver;
+	int q;
 
-	idx = e1000_mmio_beg[E1000_TDT];
-	// compute the index of the next descriptor in tx ring
-	next = (idx + 1) % TX_DESC_SZ;
+	rx_harvest();
+	for (q = 0; q < rx_nqueues; q++)
+		if (rx_queues[q].len && (recver = rx_recver(q)) &&
+		    recver->env_net_dstva)
+			rx_deliver(recver, &rx_queues[q]);
+}
 
-	// check the DD bit in the next descriptor
-	if (!tx_desc_lst[next].status.bits.DD)
-		return -E_E1000_NOT_TX;
+// deliver received packets from its queue to env 'e', as rx_deliver()
+// does, or return -E_E1000_NOT_RX if there are none
+int rx_pkt(struct Env *e)
+{
+	struct rx_queue *rq = &rx_queues[rx_env_queue[ENVX(e->env_id)]];
+
+	if (nic_owner)
+		return -E_NOT_SUPP;
+	rx_poll();
+	// once the ring is empty, go back to interrupts, checking again
+	// for a packet that came in before they were on;
+	if (!rq->len) {
+		if (!rx_polling || rx_desc_lst[rx_idx_ready].status.bits.DD)
+			return -E_E1000_NOT_RX;
+		rx_irq_enable();
+		rx_poll();
+		if (!rq->len)
+			return -E_E1000_NOT_RX;
+	}
+	return rx_deliver(e, rq);
+}
 
+// drop the packets left in queue 'rq'
+static void rx_drop(struct rx_queue *rq)
+{
+	while (rq->len) {
+		page_decref(rq->pages[rq->head]);
+		rq->head = (rq->head + 1) % RX_QUEUE_LEN;
+		rq->len--;
+	}
+}
+
+// drop the packets left in queue 'q' and let it go to another env
+static void rx_unbind(int q)
+{
+	struct rx_queue *rq = &rx_queues[q];
+
+	rq->owner = NULL;
+	rx_reta_fill();
+	if (q == 0)
+		return;
+	rx_drop(rq);
+}
+
+// make env 'e' the one that receives from queue 'q', in place of any
+// queue it had; returns the number of queues, which is all a negative
+// 'q' asks for, or -E_INVAL if there is no queue 'q' or another env
+// has it already
+int rx_bind(struct Env *e, int q)
+{
+	int old = rx_env_queue[ENVX(e->env_id)];
+
+	if (q < 0)
+		return rx_nqueues;
+	if (q >= rx_nqueues || (rx_queues[q].owner && rx_queues[q].owner != e))
+		return -E_INVAL;
+	if (rx_queues[old].owner == e && old != q)
+		rx_unbind(old);
+	rx_queues[q].owner = e;
+	rx_env_queue[ENVX(e->env_id)] = q;
+	rx_reta_fill();
+	return rx_nqueues;
+}
+
+// release the pages of descriptors the card has finished with; they
+// complete in ring order, so stop at the first one still in flight
+static void tx_reclaim(void)
+{
+	int tdt = e1000_mmio_beg[E1000_TDT];
+
+	while (tx_idx_clean != tdt && tx_desc_lst[tx_idx_clean].status.bits.DD) {
+		if (tx_page_lst[tx_idx_clean]) {
+			page_decref(tx_page_lst[tx_idx_clean]);
+			tx_page_lst[tx_idx_clean] = NULL;
+		}
+		tx_idx_clean = (tx_idx_clean + 1) % TX_DESC_SZ;
+	}
+}
+
+// number of descriptors the driver may fill; completed ones are only
+// reclaimed, in bulk, once fewer than TX_RECLAIM_LOW are left, which
+// keeps the DD reads off the common path;
+static int tx_avail(void)
+{
+	int n = (tx_idx_clean - e1000_mmio_beg[E1000_TDT] - 1 + TX_DESC_SZ)
+		% TX_DESC_SZ;
+
+	if (n >= TX_RECLAIM_LOW)
+		return n;
+	tx_reclaim();
+	return (tx_idx_clean - e1000_mmio_beg[E1000_TDT] - 1 + TX_DESC_SZ)
+		% TX_DESC_SZ;
+}
+
+// if the ring lacks room for the largest frame, put env 'e' on the wait
+// queue and return -E_AGAIN; the caller then blocks 'e', and the next
+// TXDW interrupt makes it runnable again; return 0 if there is room;
+int tx_wait(struct Env *e)
+{
+	if (nic_owner || tx_avail() >= TX_DESC_PER_PKT)
+		return 0;
+	tx_wait_link[ENVX(e->env_id)] = tx_wait_head;
+	tx_wait_head = e;
+	// a frame that completed since tx_avail() looked leaves TXDW set
+	// in ICR, so this interrupts at once rather than never
+	e1000_mmio_beg[E1000_IMS] = E1000_IMS_TXDW;
+	return -E_AGAIN;
+}
+
+// wake every env in the wait queue; each of them retries on its own
+static void tx_wake(void)
+{
+	struct Env *e;
+
+	e1000_mmio_beg[E1000_IMC] = E1000_IMS_TXDW;
+	tx_reclaim();
+	while ((e = tx_wait_head) != NULL) {
+		tx_wait_head = tx_wait_link[ENVX(e->env_id)];
+		e->env_status = ENV_RUNNABLE;
+		e->env_tf.tf_regs.reg_eax = 0;
+	}
+}
+
+// take env 'e', which is being freed, off the wait queue, and free the
+// receive queue and the card it had
+void e1000_env_free(struct Env *e)
+{
+	int q = rx_env_queue[ENVX(e->env_id)];
+	struct Env **pp;
+
+	if (e == nic_owner)
+		nic_release();
+	if (rx_queues[q].owner == e)
+		rx_unbind(q);
+	rx_env_queue[ENVX(e->env_id)] = 0;
+
+	for (pp = &tx_wait_head; *pp; pp = &tx_wait_link[ENVX((*pp)->env_id)])
+		if (*pp == e) {
+			*pp = tx_wait_link[ENVX(e->env_id)];
+			break;
+		}
+}
+
+// work out where the checksums that '*flags' asks for go in the frame at
+// user address 'data', and write a context descriptor at 'idx' unless
+// the card has that context already; '*flags' drops the ones that do not
+// apply; a JIF_TSO frame always gets a context of its own, which also
+// tells the card its header length, 'mss' and payload length; returns
+// the number of descriptors used, 0 or 1;
+static int tx_csum_ctx(int idx, const char *data, size_t nbytes, int *flags,
+		       int mss)
+{
+	// ethernet header and IPv4 header through its protocol field
+	uint8_t hdr[24];
+	struct tx_ctx_desc *cd;
+	uint8_t ipcss, ipcso, tucss, tucso, thoff;
+	uint32_t tucmd;
+	int ihl, hdrlen = 0;
+
+	if (nbytes < sizeof(hdr) || copy_from_user(hdr, data, sizeof(hdr)) < 0
+	    || hdr[12] != 0x08 || hdr[13] != 0x00 || (hdr[14] >> 4) != 4) {
+		if (*flags & JIF_TSO)
+			return -E_INVAL;
+		*flags = 0;
+		return 0;
+	}
+	ihl = (hdr[14] & 0xf) * 4;
+	ipcss = 14;
+	ipcso = ipcss + 10;
+	tucss = ipcss + ihl;
+	tucmd = E1000_TXD_CMD_IP;
+	if (hdr[23] == 6) {
+		tucso = tucss + 16;
+		tucmd |= E1000_TXD_CMD_TCP;
+	} else if (hdr[23] == 17)
+		tucso = tucss + 6;
+	else {
+		tucso = 0;
+		*flags &= ~JIF_CSUM_L4;
+	}
+
+	if (*flags & JIF_TSO) {
+		// the card copies the headers in front of every segment
+		if (!(tucmd & E1000_TXD_CMD_TCP) || mss <= 0
+		    || copy_from_user(&thoff, data + tucss + 12, 1) < 0)
+			return -E_INVAL;
+		hdrlen = tucss + (thoff >> 4) * 4;
+		if (hdrlen >= nbytes)
+			return -E_INVAL;
+		tucmd |= E1000_TXD_CMD_TSE | (nbytes - hdrlen);
+	} else if (tx_ctx.valid && tx_ctx.ipcss == ipcss
+		   && tx_ctx.ipcso == ipcso && tx_ctx.tucss == tucss
+		   && tx_ctx.tucso == tucso && tx_ctx.tucmd == tucmd)
+		return 0;
+
+	cd = (struct tx_ctx_desc *) &tx_desc_lst[idx];
+	memset(cd, 0, sizeof(*cd));
+	cd->ipcss = ipcss;
+	cd->ipcso = ipcso;
+	cd->ipcse = tucss - 1;
+	cd->tucss = tucss;
+	cd->tucso = tucso;
+	cd->tucse = 0;
+	// RS, so that the descriptor gets its DD bit like the others
+	cd->cmd_and_length = tucmd | E1000_TXD_DTYP_C | E1000_TXD_CMD_DEXT
+		| E1000_TXD_CMD_RS;
+	cd->hdr_len = hdrlen;
+	cd->mss = (*flags & JIF_TSO) ? mss : 0;
+	tx_ctx.ipcss = ipcss;
+	tx_ctx.ipcso = ipcso;
+	tx_ctx.tucss = tucss;
+	tx_ctx.tucso = tucso;
+	tx_ctx.tucmd = tucmd;
+	// the next frame without TSO needs a context without it again
+	tx_ctx.valid = !(*flags & JIF_TSO);
+	return 1;
+}
+
+// number of descriptors tx_fill() may use for the frame
+static int tx_desc_need(const char *data, size_t nbytes, int flags)
+{
+	int n = (flags & (JIF_CSUM_IP | JIF_CSUM_L4 | JIF_TSO)) ? 1 : 0;
+
+	if (nbytes < TX_COPYBREAK)
+		return n + 1;
+	return n + (PGOFF(data) + nbytes + PGSIZE - 1) / PGSIZE;
+}
+
+// write the data descriptor at 'idx' for the 'len' bytes at physical
+// address 'addr'; 'eop' if they end the frame;
+static void tx_data(int idx, uint64_t addr, size_t len, int flags, bool eop)
+{
+	struct tx_data_desc *dd;
+
+	if (flags) {
+		dd = (struct tx_data_desc *) &tx_desc_lst[idx];
+		dd->addr = addr;
+		dd->cmd_and_length = len | E1000_TXD_DTYP_D
+			| E1000_TXD_CMD_DEXT | E1000_TXD_CMD_RS
+			| (eop ? E1000_TXD_CMD_EOP : 0)
+			| ((flags & JIF_TSO) ? E1000_TXD_CMD_TSE : 0);
+		dd->popts = ((flags & JIF_CSUM_IP) ? E1000_TXD_POPTS_IXSM : 0)
+			| ((flags & JIF_CSUM_L4) ? E1000_TXD_POPTS_TXSM : 0);
+		dd->special = 0;
+		// the card sets DD again once it has sent the frame
+		dd->status = 0;
+	} else {
+		tx_desc_lst[idx].addr = addr;
+		tx_desc_lst[idx].length = len;
+		tx_desc_lst[idx].cso = 0;
+		tx_desc_lst[idx].css = 0;
+		tx_desc_lst[idx].special = 0;
+		// the slot may have held an extended descriptor before
+		tx_desc_lst[idx].cmd.raw = 0;
+		tx_desc_lst[idx].cmd.bits.RS = 1;
+		tx_desc_lst[idx].cmd.bits.EOP = eop;
+		tx_desc_lst[idx].status.raw = 0;
+	}
+}
+
+// set up descriptors from 'idx' on to send the 'nbytes'-byte frame at
+// user address 'data', with the offloads in 'flags' and, for JIF_TSO,
+// segments of 'mss' payload bytes; the caller hands them to the card by
+// moving TDT past them; returns the number of descriptors used, at most
+// tx_desc_need();
+static int tx_fill(int idx, const char *data, size_t nbytes, int flags,
+		   int mss)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+	size_t off, len;
+	int used = 0, i;
+
+	flags &= JIF_CSUM_IP | JIF_CSUM_L4 | JIF_TSO;
+	if (flags) {
+		if ((used = tx_csum_ctx(idx, data, nbytes, &flags, mss)) < 0)
+			return used;
+		idx = (idx + used) % TX_DESC_SZ;
+	}
+
+	// short frames are cheaper to copy
+	if (nbytes < TX_COPYBREAK) {
+		if (copy_from_user(tx_pkt_buffer_lst[idx], data, nbytes) < 0)
+			goto fault;
+		tx_data(idx, PADDR(tx_pkt_buffer_lst[idx]), nbytes, flags, 1);
+		TRACE(TRACE_TX_PKT, nbytes, idx);
+		return used + 1;
+	}
+
+	// others are sent straight from the user pages, a descriptor for
+	// each page the frame touches; the pages stay pinned until
+	// tx_reclaim() sees them done;
+	for (off = 0, i = idx; off < nbytes; off += len) {
+		len = MIN(nbytes - off, PGSIZE - PGOFF(data + off));
+		if (!(pp = page_lookup(curenv->env_pgdir,
+				       (void *) (data + off), &pte))
+		    || !(*pte & PTE_U)) {
+			// unpin what this frame pinned so far
+			for (; i != idx; idx = (idx + 1) % TX_DESC_SZ) {
+				page_decref(tx_page_lst[idx]);
+				tx_page_lst[idx] = NULL;
+			}
+			goto fault;
+		}
+		pp->pp_ref++;
+		tx_page_lst[i] = pp;
+		tx_data(i, page2pa(pp) + PGOFF(data + off), len, flags,
+			off + len == nbytes);
+		i = (i + 1) % TX_DESC_SZ;
+		used++;
+	}
+	TRACE(TRACE_TX_PKT, nbytes, idx);
+	return used;
+
+fault:
+	// the context descriptor, if any, never reaches the card
+	tx_ctx.valid = 0;
+	return -E_FAULT;
+}
+
+// queue the frame at user address 'data'; returns -E_AGAIN at once if
+// the ring is full;
+int tx_pkt(const char *data, size_t nbytes)
+{
+	int idx, r;
+
+	if (nic_owner)
+		return -E_NOT_SUPP;
 	if (nbytes >= ETH_PKT_SZ)
 		return -E_INVAL;
+	if (tx_avail() < tx_desc_need(data, nbytes, 0))
+		return -E_AGAIN;
+
+	// initialize the descriptors from TDT on and then move TDT past
+	// them, which hands the frame to the card; TDT then points to the
+	// next free descriptor;
+	idx = e1000_mmio_beg[E1000_TDT];
+	if ((r = tx_fill(idx, data, nbytes, 0, 0)) < 0)
+		return r;
+	e1000_mmio_beg[E1000_TDT] = (idx + r) % TX_DESC_SZ;
+	return 0;
+}
+
+// queue up to 'n' frames from the consecutive struct jif_pkt records at
+// user address 'pkts', with the offloads in their jp_flags, and write TDT
+// once for all of them; returns the number queued, which is short if
+// the ring fills up or a record is bad, or -E_AGAIN if the first frame
+// does not fit;
+int tx_pkt_batch(const struct jif_pkt *pkts, int n)
+{
+	struct jif_pkt hdr;
+	int idx, room, i, r = 0;
+
+	if (nic_owner)
+		return -E_NOT_SUPP;
+	room = tx_avail();
+	idx = e1000_mmio_beg[E1000_TDT];
+	for (i = 0; i < n; i++) {
+		if (copy_from_user(&hdr, pkts, sizeof(hdr)) < 0) {
+			r = -E_FAULT;
+			break;
+		}
+		if (hdr.jp_len < 0 || hdr.jp_len >= ((hdr.jp_flags & JIF_TSO)
+						     ? JIF_TSO_MAX + 1
+						     : ETH_PKT_SZ)) {
+			r = -E_INVAL;
+			break;
+		}
+		if (room < tx_desc_need(pkts->jp_data, hdr.jp_len,
+					hdr.jp_flags)) {
+			r = -E_AGAIN;
+			break;
+		}
+		if ((r = tx_fill(idx, pkts->jp_data, hdr.jp_len,
+				 hdr.jp_flags, hdr.jp_mss)) < 0)
+			break;
+		idx = (idx + r) % TX_DESC_SZ;
+		room -= r;
+		pkts = (const struct jif_pkt *)
+			ROUNDUP((uintptr_t) pkts->jp_data + hdr.jp_len, 4);
+	}
+	e1000_mmio_beg[E1000_TDT] = idx;
+	return i ? i : r;
+}
+
+/*
+ * The card driven from user space: the network server can take it over
+ * with sys_nic_map, and then gets rings and buffers of its own, mapped
+ * into its address space, in place of the driver's (see inc/nicring.h).
+ * The kernel only writes the descriptors it hands the card, in
+ * nic_kick(), and passes the card's interrupts on as IPCs.
+ */
+
+// the pages nic_map() maps: rings, control page, buffers
+static struct PageInfo *nic_pages[NIC_MAP_PAGES];
+// the IPC value the owner gets for an interrupt, and whether one came
+// while it was not waiting for it
+static uint32_t nic_ipc_value;
+static bool nic_pending;
+
+static struct rx_desc *nic_rx_ring(void)
+{
+	return (struct rx_desc *) NIC_RINGS(page2kva(nic_pages[0]))->rx;
+}
+
+static struct tx_desc *nic_tx_ring(void)
+{
+	return (struct tx_desc *) NIC_RINGS(page2kva(nic_pages[0]))->tx;
+}
+
+// physical address of buffer 'i', counting rx buffers first
+static physaddr_t nic_buf_pa(int i)
+{
+	return page2pa(nic_pages[2 + i * NIC_BUF_SZ / PGSIZE]) +
+		i * NIC_BUF_SZ % PGSIZE;
+}
+
+// point the card at new rings; it is stopped while this happens
+static void nic_set_rings(physaddr_t rx, int rxlen, int rdh, int rdt,
+			  physaddr_t tx, int txlen, bool lpe)
+{
+	e1000_mmio_beg[E1000_RCTL] &= ~E1000_RCTL_EN;
+	e1000_mmio_beg[E1000_TCTL] &= ~E1000_TCTL_EN;
+
+	e1000_mmio_beg[E1000_RDBAL] = rx;
+	e1000_mmio_beg[E1000_RDLEN] = rxlen;
+	e1000_mmio_beg[E1000_RDH] = rdh;
+	e1000_mmio_beg[E1000_RDT] = rdt;
+	e1000_mmio_beg[E1000_TDBAL] = tx;
+	e1000_mmio_beg[E1000_TDLEN] = txlen;
+	e1000_mmio_beg[E1000_TDH] = 0;
+	e1000_mmio_beg[E1000_TDT] = 0;
+	if (lpe)
+		e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_LPE;
+	else
+		e1000_mmio_beg[E1000_RCTL] &= ~E1000_RCTL_LPE;
+
+	e1000_mmio_beg[E1000_TCTL] |= E1000_TCTL_EN;
+	e1000_mmio_beg[E1000_RCTL] |= E1000_RCTL_EN;
+}
+
+// give env 'e' the card, with its rings and buffers mapped at 'va',
+// until it is freed; each interrupt reaches it as an IPC of 'value'
+// from envid 0; the driver drops the packets it had received for its
+// own receivers and those it had yet to send, and the envs blocked on
+// it return -E_NOT_SUPP;
+int nic_map(struct Env *e, void *va, uint32_t value)
+{
+	struct rx_desc *rx;
+	struct Env *o;
+	int i, r, perm;
+
+	if (nic_owner)
+		return -E_INVAL;
+	for (i = 0; i < NIC_MAP_PAGES; i++) {
+		// the rings are the kernel's to write
+		perm = i ? PTE_P | PTE_U | PTE_W : PTE_P | PTE_U;
+		if (!(nic_pages[i] = page_alloc(ALLOC_ZERO))) {
+			r = -E_NO_MEM;
+			goto fail;
+		}
+		nic_pages[i]->pp_ref++;
+		if ((r = page_insert(e->env_pgdir, nic_pages[i],
+				     (char *) va + i * PGSIZE, perm)) < 0) {
+			i++;
+			goto fail;
+		}
+	}
+
+	rx = nic_rx_ring();
+	for (i = 0; i < NIC_RX_SLOTS; i++)
+		rx[i].addr = nic_buf_pa(i);
 
-	// DD was set? next descriptor is free, we are good to go with
-	// initializing the current descriptor and then incrementing TDT;
-	// then, TDT will point to the next free descriptor;
-	memmove(tx_pkt_buffer_lst[idx], data, nbytes);
-	tx_desc_lst[idx].length = nbytes;
-	tx_desc_lst[idx].cmd.bits.RS = 1;
-	tx_desc_lst[idx].cmd.bits.EOP = 1;
-	// store in TDT the index of the next free descriptor;
-	e1000_mmio_beg[E1000_TDT] = next;
+	nic_owner = e;
+	nic_ipc_value = value;
+	nic_pending = 0;
+	// the owner's buffers take a frame each; all of its rx slots but
+	// one are the card's to start with
+	nic_set_rings(page2pa(nic_pages[0]), NIC_RX_SLOTS * sizeof(*rx),
+		      0, NIC_RX_SLOTS - 1,
+		      page2pa(nic_pages[0]) + NIC_RX_SLOTS * sizeof(*rx),
+		      NIC_TX_SLOTS * sizeof(struct tx_desc), 0);
+	// only now that the card has left the driver's tx ring can the
+	// pages it was still sending from go
+	for (i = 0; i < TX_DESC_SZ; i++)
+		if (tx_page_lst[i]) {
+			page_decref(tx_page_lst[i]);
+			tx_page_lst[i] = NULL;
+		}
+	// the driver's rings are not looked at again until nic_release(),
+	// so the envs blocked on them get the error the syscalls now
+	// return, and the frames already queued are dropped
+	while ((o = tx_wait_head) != NULL) {
+		tx_wait_head = tx_wait_link[ENVX(o->env_id)];
+		o->env_status = ENV_RUNNABLE;
+		o->env_tf.tf_regs.reg_eax = -E_NOT_SUPP;
+	}
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_net_recving) {
+			envs[i].env_net_recving = 0;
+			envs[i].env_net_value = -E_NOT_SUPP;
+			envs[i].env_tf.tf_regs.reg_eax = -E_NOT_SUPP;
+			envs[i].env_status = ENV_RUNNABLE;
+		}
+	for (i = 0; i < RX_NUM_OF_QUEUES; i++)
+		rx_drop(&rx_queues[i]);
+	rx_polling = 0;
+	e1000_mmio_beg[E1000_IMS] = E1000_IMS_RXT0 | E1000_IMS_TXDW;
 	return 0;
+
+fail:
+	while (--i >= 0) {
+		page_remove(e->env_pgdir, (char *) va + i * PGSIZE);
+		page_decref(nic_pages[i]);
+		nic_pages[i] = NULL;
+	}
+	return r;
+}
+
+// hand the card the owner's rx descriptors from the current RDT up to
+// just before 'rdt', and its tx descriptors from TDT up to just before
+// 'tdt', writing each of them first: rx ones get their buffer back and
+// a clear status; tx ones their buffer, the frame length the control
+// page gives and a plain end-of-packet command; returns -E_INVAL if
+// 'e' is not the owner or a tail is out of range
+int nic_kick(struct Env *e, int rdt, int tdt)
+{
+	struct nic_ctl *ctl;
+	struct rx_desc *rx;
+	struct tx_desc *tx;
+	int i;
+
+	if (e != nic_owner || rdt < 0 || rdt >= NIC_RX_SLOTS ||
+	    tdt < 0 || tdt >= NIC_TX_SLOTS)
+		return -E_INVAL;
+	rx = nic_rx_ring();
+	for (i = e1000_mmio_beg[E1000_RDT]; i != rdt;
+	     i = (i + 1) % NIC_RX_SLOTS) {
+		rx[i].addr = nic_buf_pa(i);
+		rx[i].status.raw = 0;
+		rx[i].errors.raw = 0;
+	}
+	tx = nic_tx_ring();
+	ctl = NIC_CTL(page2kva(nic_pages[1]));
+	for (i = e1000_mmio_beg[E1000_TDT]; i != tdt;
+	     i = (i + 1) % NIC_TX_SLOTS) {
+		tx[i].addr = nic_buf_pa(NIC_RX_SLOTS + i);
+		tx[i].length = MIN(ctl->tx_len[i], NIC_BUF_SZ);
+		tx[i].cso = 0;
+		tx[i].cmd.raw = 0;
+		tx[i].cmd.bits.EOP = 1;
+		tx[i].cmd.bits.IFCS = 1;
+		tx[i].cmd.bits.RS = 1;
+		tx[i].status.raw = 0;
+		tx[i].css = 0;
+		tx[i].special = 0;
+	}
+	e1000_mmio_beg[E1000_RDT] = rdt;
+	e1000_mmio_beg[E1000_TDT] = tdt;
+	return 0;
+}
+
+// pass an interrupt on to the owner, now if it waits in sys_ipc_recv,
+// else at its next one
+static void nic_notify(void)
+{
+	struct Env *e = nic_owner;
+
+	if (!e->env_ipc_recving) {
+		nic_pending = 1;
+		return;
+	}
+	e->env_ipc_recving = 0;
+	e->env_ipc_value = nic_ipc_value;
+	e->env_ipc_from = 0;
+	e->env_ipc_perm = 0;
+	timer_env_cancel(e);
+	e->env_status = ENV_RUNNABLE;
+	e->env_tf.tf_regs.reg_eax = 0;
+}
+
+// if an interrupt is pending for env 'e', which is about to wait in
+// sys_ipc_recv, deliver it and return 1; the wait is then over
+int nic_ipc_pending(struct Env *e)
+{
+	if (e != nic_owner || !nic_pending)
+		return 0;
+	nic_pending = 0;
+	e->env_ipc_value = nic_ipc_value;
+	e->env_ipc_from = 0;
+	e->env_ipc_perm = 0;
+	return 1;
+}
+
+// the owner is gone: go back to the driver's own rings, empty, and
+// free the owner's pages
+static void nic_release(void)
+{
+	int i;
+
+	e1000_mmio_beg[E1000_IMC] = E1000_IMS_RXT0 | E1000_IMS_TXDW;
+	for (i = 0; i < RX_NUM_OF_DESC; i++) {
+		rx_desc_lst[i].status.raw = 0;
+		rx_desc_lst[i].errors.raw = 0;
+	}
+	tx_idx_clean = 0;
+	tx_ctx.valid = 0;
+	nic_set_rings(PADDR(&rx_desc_lst), sizeof(rx_desc_lst), rx_idx_ready,
+		      (rx_idx_ready + RX_NUM_OF_DESC - 1) % RX_NUM_OF_DESC,
+		      PADDR(&tx_desc_lst), sizeof(tx_desc_lst),
+		      ETH_PKT_SZ > 1522);
+	for (i = 0; i < NIC_MAP_PAGES; i++) {
+		page_decref(nic_pages[i]);
+		nic_pages[i] = NULL;
+	}
+	nic_owner = NULL;
+	nic_pending = 0;
+	e1000_mmio_beg[E1000_IMS] = E1000_IMS_RXT0;
 }
@@ -4,6 +4,8 @@
 #include <kern/pci.h>
 #include <kern/env.h>
 #include <inc/error.h>
+#include <inc/netpkt.h>
+#include <inc/nicring.h>
 
 // maybe i should even make source files for tx and rx instead of
 // keeping it at one place?
@@ -15,7 +17,15 @@
  *****************************************************************************
  */
 #define TX_DESC_SZ 64
-#define ETH_PKT_SZ 1518
+// largest frame without JIF_TSO, with the CRC the card appends
+#define ETH_PKT_SZ (JIF_FRAME_MAX + 4)
+// frames shorter than this are copied rather than sent from the user page
+#define TX_COPYBREAK 256
+// most descriptors one frame takes: a context descriptor and the data,
+// which needs one per page it touches when it is not copied
+#define TX_DESC_PER_PKT (2 + JIF_TSO_MAX / PGSIZE)
+// reclaim completed tx descriptors once fewer than this many are free
+#define TX_RECLAIM_LOW TX_DESC_PER_PKT
 
 // divide by 4 in order to use them as array indices
 #define E1000_TCTL     (0x00400/4) /* TX Control - RW */
@@ -93,6 +103,43 @@ struct tx_desc {
 	uint16_t special;
 };
 
+// TCP/IP context descriptor (DEXT set, DTYP 0): sets up checksum
+// offload, and with TSE segmentation, for the data descriptors that
+// follow it
+struct tx_ctx_desc {
+	uint8_t ipcss;			// IP checksum start
+	uint8_t ipcso;			// IP checksum offset
+	uint16_t ipcse;			// IP checksum end, inclusive
+	uint8_t tucss;			// TCP/UDP checksum start
+	uint8_t tucso;			// TCP/UDP checksum offset
+	uint16_t tucse;			// TCP/UDP checksum end, 0 for the
+					// end of the frame
+	uint32_t cmd_and_length;	// TUCMD | DTYP | PAYLEN
+	uint8_t status;
+	uint8_t hdr_len;
+	uint16_t mss;
+};
+
+// TCP/IP data descriptor (DEXT set, DTYP 1)
+struct tx_data_desc {
+	uint64_t addr;
+	uint32_t cmd_and_length;	// DCMD | DTYP | DTALEN
+	uint8_t status;
+	uint8_t popts;
+	uint16_t special;
+};
+
+#define E1000_TXD_DTYP_D     0x00100000 /* Data Descriptor */
+#define E1000_TXD_DTYP_C     0x00000000 /* Context Descriptor */
+#define E1000_TXD_CMD_EOP    0x01000000 /* End of Packet */
+#define E1000_TXD_CMD_TSE    0x04000000 /* TCP Segmentation Enable */
+#define E1000_TXD_CMD_TCP    0x01000000 /* Context: TCP, not UDP */
+#define E1000_TXD_CMD_IP     0x02000000 /* Context: IPv4 */
+#define E1000_TXD_CMD_RS     0x08000000 /* Report Status */
+#define E1000_TXD_CMD_DEXT   0x20000000 /* Descriptor extension */
+#define E1000_TXD_POPTS_IXSM 0x01       /* Insert IP checksum */
+#define E1000_TXD_POPTS_TXSM 0x02       /* Insert TCP/UDP checksum */
+
 /*****************************************************************************
  *
  *                    RX STUFF
@@ -100,7 +147,30 @@ struct tx_desc {
  *****************************************************************************
  */
 #define RX_NUM_OF_DESC 128
-#define RX_DESC_SZ     4096
+// each rx descriptor owns a page that becomes a struct jif_pkt when it
+// is handed to the receiver; the card writes the frame right after the
+// jp_len word, RX_BUF_SZ bytes at most; a longer frame (RCTL.LPE, when
+// JIF_MTU asks for jumbo frames) fills several descriptors
+#define RX_PKT_HDR     offsetof(struct jif_pkt, jp_data)
+#define RX_BUF_SZ      2048
+// pages of the longest frame the card takes with RCTL.LPE, 16384 bytes
+#define RX_PKT_PAGES_MAX ((RX_PKT_HDR + 16384 + PGSIZE - 1) / PGSIZE)
+
+// receive queues the driver spreads flows over, at most one per CPU;
+// each holds up to RX_QUEUE_LEN received pages for its input env, one
+// or more per packet (JIF_PKT_PAGES); the redirection table maps the
+// low bits of a flow's hash to a queue
+#define RX_NUM_OF_QUEUES 4
+#define RX_QUEUE_LEN   64
+#define RX_RETA_SZ     128
+
+// rx interrupt moderation: after a frame, the card waits RX_DELAY for
+// another before interrupting, but no longer than RX_ABS_DELAY after the
+// first one (both in 1.024us units); and it interrupts at most about
+// NIC_IRQ_RATE times a second in any case (ITR counts 256ns units)
+#define RX_DELAY       32
+#define RX_ABS_DELAY   128
+#define NIC_IRQ_RATE   20000
 
 #define E1000_RDBAL    (0x02800/4) /* RX Descriptor Base Address Low - RW */
 #define E1000_RDBAH    (0x02804/4) /* RX Descriptor Base Address High - RW */
@@ -108,7 +178,10 @@ struct tx_desc {
 #define E1000_RDH      (0x02810/4) /* RX Descriptor Head - RW */
 #define E1000_RDT      (0x02818/4) /* RX Descriptor Tail - RW */
 #define E1000_RDTR     (0x02820/4) /* RX Delay Timer - RW */
+#define E1000_RADV     (0x0282C/4) /* RX Interrupt Absolute Delay Timer - RW */
+#define E1000_ITR      (0x000C4/4) /* Interrupt Throttling Rate - RW */
 #define E1000_RCTL     (0x00100/4) /* RX Control - RW */
+#define E1000_RXCSUM   (0x05000/4) /* RX Checksum Control - RW */
 #define E1000_RAL0     (0x05400/4) /* Receive Address - RW Array */
 #define E1000_RAH0     (0x05404/4) /* Receive Address - RW Array */
 #define E1000_IMC      (0x000D8/4) /* Interrupt Mask Clear - WO */
@@ -126,6 +199,10 @@ struct tx_desc {
 #define E1000_RDLEN1   0x02908  /* RX Descriptor Length (1) - RW */
 #define E1000_RDH1     0x02910  /* RX Descriptor Head (1) - RW */
 #define E1000_RDT1     0x02918  /* RX Descriptor Tail (1) - RW */
+/* Receive Checksum Control */
+#define E1000_RXCSUM_IPOFL 0x00000100 /* IPv4 checksum offload */
+#define E1000_RXCSUM_TUOFL 0x00000200 /* TCP / UDP checksum offload */
+
 /* Receive Control */
 #define E1000_RCTL_RST            0x00000001    /* Software reset */
 #define E1000_RCTL_EN             0x00000002    /* enable */
@@ -154,6 +231,7 @@ struct tx_desc {
 #define E1000_RCTL_SZ_1024        0x00010000    /* rx buffer size 1024 */
 #define E1000_RCTL_SZ_512         0x00020000    /* rx buffer size 512 */
 #define E1000_RCTL_SZ_256         0x00030000    /* rx buffer size 256 */
+#define E1000_RCTL_SZ_MASK        0x00030000    /* rx buffer size bits */
 /* these buffer sizes are valid if E1000_RCTL_BSEX is 1 */
 #define E1000_RCTL_SZ_16384       0x00010000    /* rx buffer size 16384 */
 #define E1000_RCTL_SZ_8192        0x00020000    /* rx buffer size 8192 */
@@ -309,10 +387,17 @@ struct rx_desc {
 int e1000_attach(struct pci_func *pcif);
 extern struct pci_func e1000_pci_func;
 
-int tx_pkt(const char *data, uint8_t nbytes);
+int tx_pkt(const char *data, size_t nbytes);
+int tx_pkt_batch(const struct jif_pkt *pkts, int n);
+int tx_wait(struct Env *e);
+void e1000_env_free(struct Env *e);
 extern struct tx_desc tx_desc_lst[];
-extern uint8_t pkt_buffer_lst[][ETH_PKT_SZ];
 
 void nic_irq_handler(void);
 int rx_pkt(struct Env *);
+int rx_bind(struct Env *e, int q);
+
+int nic_map(struct Env *e, void *va, uint32_t value);
+int nic_kick(struct Env *e, int rdt, int tdt);
+int nic_ipc_pending(struct Env *e);
 #endif	// JOS_KERN_E1000_H
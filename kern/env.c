@@ -14,6 +14,11 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/timer.h>
+#include <kern/fpu.h>
+#include <kern/trace.h>
+#include <kern/sysstat.h>
+#include <kern/e1000.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
@@ -145,19 +150,6 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
-// returns the particular environment that is currently waiting
-// for network packets;
-struct Env *env_net_recver(void)
-{
-	int i;
-
-	for (i = 0; i < NENV; i++) {
-		if (envs[i].env_net_recving)
-			return &envs[i];
-	}
-	return NULL;
-}
-
 // Mark all environments in 'envs' as free, set their env_ids to 0,
 // and insert them into the env_free_list.
 // Make sure the environments are in the free list in the same order
@@ -428,7 +420,7 @@ load_icode(struct Env *e, uint8_t *binary)
 
 	// this is needed in order to allocate pages in env's PDE within
 	// region_alloc function - there's a page_alloc() call;
-	lcr3(PADDR(e->env_pgdir));
+	load_pgdir(e->env_pgdir);
 
 	// check elf header
 	elfhdr = (struct Elf *)binary;
@@ -470,7 +462,7 @@ load_icode(struct Env *e, uint8_t *binary)
 	// LAB 3: Your code here.
 	region_alloc(e, (void *)(USTACKTOP - PGSIZE), PGSIZE);
 
-	lcr3(PADDR(kern_pgdir));
+	load_pgdir(kern_pgdir);
 }
 
 //
@@ -510,11 +502,18 @@ env_free(struct Env *e)
 	// before freeing the page directory, just in case the page
 	// gets reused.
 	if (e == curenv)
-		lcr3(PADDR(kern_pgdir));
+		load_pgdir(kern_pgdir);
 
 	// Note the environment's demise.
 	cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
+	// A pending sleep or IPC timeout must not fire on a reused slot
+	timer_env_cancel(e);
+	fpu_env_free(e);
+	sysstat_env_free(e);
+	e1000_env_free(e);
+	sched_env_free(e);
+
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
 	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
@@ -523,6 +522,12 @@ env_free(struct Env *e)
 		if (!(e->env_pgdir[pdeno] & PTE_P))
 			continue;
 
+		// 4MB pages have no page table
+		if (e->env_pgdir[pdeno] & PTE_PS) {
+			page_remove(e->env_pgdir, PGADDR(pdeno, 0, 0));
+			continue;
+		}
+
 		// find the pa and va of the page table
 		pa = PTE_ADDR(e->env_pgdir[pdeno]);
 		pt = (pte_t*) KADDR(pa);
@@ -583,8 +588,11 @@ env_destroy(struct Env *e)
 void
 env_pop_tf(struct Trapframe *tf)
 {
-	// Record the CPU we are running on for user-space debugging
-	curenv->env_cpunum = cpunum();
+	// Record the CPU we are running on for user-space debugging.
+	// A TLB shootdown IPI taken in the idle loop resumes with no
+	// curenv.
+	if (curenv)
+		curenv->env_cpunum = cpunum();
 
 	__asm __volatile("movl %0,%%esp\n"
 		"\tpopal\n"
@@ -605,6 +613,7 @@ env_pop_tf(struct Trapframe *tf)
 void
 env_run(struct Env *e)
 {
+	TRACE(TRACE_ENV_RUN, e->env_id, 0);
 	// Step 1: If this is a context switch (a new environment is running):
 	//	   1. Set the current environment (if any) back to
 	//	      ENV_RUNNABLE if it is ENV_RUNNING (think about
@@ -612,6 +621,10 @@ env_run(struct Env *e)
 	if (curenv && curenv->env_status == ENV_RUNNING) {
 		curenv->env_status = ENV_RUNNABLE;
 	}
+	//	      Save the FPU state of the old environment if it
+	//	      used the FPU; the new one traps on its first use.
+	if (curenv != e)
+		fpu_release();
 	//	   2. Set 'curenv' to the new environment,
 	curenv = e;
 	//	   3. Set its status to ENV_RUNNING,
@@ -619,10 +632,14 @@ env_run(struct Env *e)
 	//	   4. Update its 'env_runs' counter,
 	curenv->env_runs += 1;
 	//	   5. Use lcr3() to switch to its address space.
-	lcr3(PADDR(curenv->env_pgdir));
+	//	      (load_pgdir() skips it if we stay in the same one.)
+	load_pgdir(curenv->env_pgdir);
 	// Step 2: Use env_pop_tf() to restore the environment's
 	//	   registers and drop into user mode in the
 	//	   environment.
+	tlb_shootdown();
+	sysstat_exit();
+	thiscpu->cpu_in_kernel = 0;
 	unlock_kernel();
 	env_pop_tf(&curenv->env_tf);
 
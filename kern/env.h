@@ -22,7 +22,6 @@ int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 
-struct Env *env_net_recver(void);
 
 char *env_str_status(int status);
 char *env_str_type(enum EnvType type);
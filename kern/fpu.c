@@ -0,0 +1,181 @@
+// Lazy FPU/SSE context switching.
+//
+// Each CPU tracks the environment whose FPU state is in its registers
+// (cpu_fpu_owner), and whether that state is live, i.e. newer than the
+// environment's save area (cpu_fpu_live).  CR0.TS is clear exactly when
+// the state is live.  A live state is saved when its environment leaves
+// the CPU; an environment that comes back to a CPU nobody else used the
+// FPU on in the meantime gets its registers back without an fxrstor.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/fpu.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+
+#define FXSAVE_SIZE	512
+#define MXCSR_DEFAULT	0x1f80		// All SIMD exceptions masked
+#define FCW_DEFAULT	0x037f		// State after fninit
+
+// Per-env FPU state, indexed by ENVX.  The 512-byte fxsave area is
+// allocated on the environment's first FPU instruction.
+struct FpuSlot {
+	void *fs_area;		// fxsave image; NULL if never used the FPU
+	int fs_cpu;		// CPU whose registers still match fs_area, or -1
+};
+
+static struct FpuSlot fpu_slots[NENV];
+
+static void
+stts(void)
+{
+	lcr0(rcr0() | CR0_TS);
+}
+
+static void
+fxsave(void *area)
+{
+	asm volatile("fxsave (%0)" : : "r" (area) : "memory");
+}
+
+static void
+fxrstor(void *area)
+{
+	asm volatile("fxrstor (%0)" : : "r" (area) : "memory");
+}
+
+static struct FpuSlot *
+fpu_slot(struct Env *e)
+{
+	return &fpu_slots[ENVX(e->env_id)];
+}
+
+//
+// Enable fxsave/fxrstor and SSE on this CPU, and arm CR0.TS so the
+// first FPU instruction of any environment traps.
+//
+void
+fpu_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	// fxsave/fxrstor (bit 24) and SSE (bit 25)
+	if (!(edx & (1 << 24)) || !(edx & (1 << 25)))
+		panic("fpu_init: CPU %d lacks FXSR/SSE", cpunum());
+
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	lcr0((rcr0() | CR0_MP | CR0_NE) & ~(CR0_EM | CR0_TS));
+	asm volatile("fninit");
+	stts();
+	thiscpu->cpu_fpu_owner = NULL;
+	thiscpu->cpu_fpu_live = 0;
+}
+
+// Allocate a save area for 's' holding the power-up FPU state, so no
+// register contents leak from the previous owner of the FPU.
+static int
+fpu_alloc(struct FpuSlot *s)
+{
+	struct PageInfo *pp;
+
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	s->fs_area = page2kva(pp);
+	*(uint16_t *) s->fs_area = FCW_DEFAULT;
+	*(uint32_t *) ((char *) s->fs_area + 24) = MXCSR_DEFAULT;
+	s->fs_cpu = -1;
+	return 0;
+}
+
+//
+// Handle #NM: curenv used the FPU for the first time since it was run.
+//
+void
+fpu_trap(struct Trapframe *tf)
+{
+	struct CpuInfo *c = thiscpu;
+	struct FpuSlot *s = fpu_slot(curenv);
+
+	assert(!c->cpu_fpu_live);
+	clts();
+	if (!s->fs_area || c->cpu_fpu_owner != curenv
+	    || s->fs_cpu != cpunum()) {
+		if (!s->fs_area && fpu_alloc(s) < 0) {
+			stts();
+			cprintf("[%08x] out of memory for FPU state\n",
+				curenv->env_id);
+			env_destroy(curenv);
+			return;
+		}
+		fxrstor(s->fs_area);
+		c->cpu_fpu_owner = curenv;
+		s->fs_cpu = cpunum();
+	}
+	c->cpu_fpu_live = 1;
+}
+
+//
+// Called by env_run() and sched_halt() when curenv is about to stop
+// running on this CPU.
+//
+void
+fpu_release(void)
+{
+	struct CpuInfo *c = thiscpu;
+
+	if (!c->cpu_fpu_live)
+		return;
+	// The registers keep matching the save area, so fs_cpu stays
+	fxsave(fpu_slot(c->cpu_fpu_owner)->fs_area);
+	c->cpu_fpu_live = 0;
+	stts();
+}
+
+//
+// Give 'child' a copy of the FPU state of 'parent', which is curenv.
+//
+int
+fpu_fork(struct Env *child, struct Env *parent)
+{
+	struct FpuSlot *ps = fpu_slot(parent), *cs = fpu_slot(child);
+	int r;
+
+	if (!ps->fs_area)
+		return 0;
+	if (thiscpu->cpu_fpu_live && thiscpu->cpu_fpu_owner == parent)
+		fxsave(ps->fs_area);
+	if (!cs->fs_area && (r = fpu_alloc(cs)) < 0)
+		return r;
+	memcpy(cs->fs_area, ps->fs_area, FXSAVE_SIZE);
+	cs->fs_cpu = -1;
+	return 0;
+}
+
+//
+// Release the FPU state of 'e'.  Any CPU that still has 'e' as its
+// owner sees fs_cpu == -1 and reloads when the slot is reused.
+//
+void
+fpu_env_free(struct Env *e)
+{
+	struct FpuSlot *s = fpu_slot(e);
+
+	if (thiscpu->cpu_fpu_owner == e) {
+		if (thiscpu->cpu_fpu_live)
+			stts();
+		thiscpu->cpu_fpu_owner = NULL;
+		thiscpu->cpu_fpu_live = 0;
+	}
+	if (s->fs_area)
+		page_decref(pa2page(PADDR(s->fs_area)));
+	s->fs_area = NULL;
+	s->fs_cpu = -1;
+}
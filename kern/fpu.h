@@ -0,0 +1,20 @@
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+struct Env;
+struct Trapframe;
+
+// Lazy FPU/SSE context switching.  CR0.TS is set whenever a different
+// environment is run, so the first FPU or SSE instruction it executes
+// raises #NM and fpu_trap() loads its state.  Environments that never
+// touch the FPU pay nothing.
+void fpu_init(void);
+void fpu_trap(struct Trapframe *tf);
+void fpu_release(void);
+int fpu_fork(struct Env *child, struct Env *parent);
+void fpu_env_free(struct Env *e);
+
+#endif /* JOS_KERN_FPU_H */
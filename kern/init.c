@@ -15,7 +15,10 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/timer.h>
 #include <kern/pci.h>
+#include <kern/fpu.h>
+#include <kern/trace.h>
 
 static void boot_aps(void);
 
@@ -46,12 +49,15 @@ i386_init(void)
 	// Lab 4 multiprocessor initialization functions
 	mp_init();
 	lapic_init();
+	fpu_init();
+	trace_init();
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
 
 	// Lab 6 hardware initialization functions
 	time_init();
+	timer_init();
 	pci_init();
 
 	// Acquire the big kernel lock before waking up APs
@@ -121,12 +127,13 @@ void
 mp_main(void)
 {
 	// We are in high EIP now, safe to switch to kern_pgdir 
-	lcr3(PADDR(kern_pgdir));
+	load_pgdir(kern_pgdir);
 	cprintf("SMP: CPU %d starting\n", cpunum());
 
 	lapic_init();
 	env_init_percpu();
 	trap_init_percpu();
+	fpu_init();
 	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
 
 	// Now that we have finished some basic setup, call sched_yield()
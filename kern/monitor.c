@@ -11,6 +11,7 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/prof.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -26,6 +27,7 @@ static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
 	{ "backtrace", "Show backtrace", mon_backtrace },
+	{ "prof", "Sampling profiler: prof start|stop|dump", mon_prof },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -80,6 +82,23 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_prof(int argc, char **argv, struct Trapframe *tf)
+{
+	int r;
+
+	if (argc == 2 && strcmp(argv[1], "start") == 0) {
+		if ((r = prof_start()) < 0)
+			cprintf("prof: %e\n", r);
+	} else if (argc == 2 && strcmp(argv[1], "stop") == 0)
+		prof_stop();
+	else if (argc == 2 && strcmp(argv[1], "dump") == 0)
+		prof_print();
+	else
+		cprintf("usage: prof start|stop|dump\n");
+	return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
@@ -10,6 +10,7 @@
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/spinlock.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -19,7 +20,36 @@ static size_t npages_basemem;	// Amount of base memory (in pages)
 // These variables are set in mem_init()
 pde_t *kern_pgdir;		// Kernel's initial page directory
 struct PageInfo *pages;		// Physical page state array
-static struct PageInfo *page_free_list;	// Free list of physical pages
+
+// Buddy allocator free lists: free_area[k] holds free blocks of 2^k
+// contiguous pages, each aligned to its own size.
+static struct PageInfo *free_area[MAX_ORDER + 1];
+static struct spinlock buddy_lock = {
+#ifdef DEBUG_SPINLOCK
+	.name = "buddy_lock"
+#endif
+};
+
+// Pages zeroed ahead of time by idle CPUs, for page_alloc(ALLOC_ZERO).
+// Also protected by buddy_lock.
+static struct PageInfo *zero_pool;
+static int zero_pool_count;
+
+// Pending TLB shootdown (see tlb_shootdown() below).
+#define TLB_BATCH_MAX	32
+
+static struct {
+	pde_t *pgdir;			// Address space of va[]
+	int nva;			// Entries in va[]; -1 to flush everything
+	uintptr_t va[TLB_BATCH_MAX];
+	uint32_t cpumask;		// CPUs that must flush
+	struct PageInfo *free;		// Pages to free after the flush
+	volatile uint32_t pending;	// CPUs that have not flushed yet
+} tlb_batch;
+
+// Until mem_init() loads kern_pgdir, entry_pgdir maps only the first
+// 4MB of physical memory, so no page above that may be handed out.
+static physaddr_t buddy_limit = PTSIZE;
 
 
 // --------------------------------------------------------------
@@ -83,7 +113,7 @@ static void check_page_installed_pgdir(void);
 //
 // If we're out of memory, boot_alloc should panic.
 // This function may ONLY be used during initialization,
-// before the page_free_list list has been set up.
+// before the buddy free lists have been set up.
 static void *
 boot_alloc(uint32_t n)
 {
@@ -227,7 +257,11 @@ mem_init(void)
 	//    - the new image at UENVS  -- kernel R, user R
 	//    - envs itself -- kernel RW, user NONE
 	// LAB 3: Your code here.
-	boot_map_region(kern_pgdir, UENVS, PTSIZE, PADDR(envs), PTE_U | PTE_P);
+	// The upper half of the slot holds the trace buffers (see trace.c).
+	static_assert(NENV * sizeof(struct Env) <= UTRACE - UENVS);
+	boot_map_region(kern_pgdir, UENVS,
+			ROUNDUP(NENV * sizeof(struct Env), PGSIZE),
+			PADDR(envs), PTE_U | PTE_P);
 
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
@@ -253,9 +287,10 @@ mem_init(void)
 	// we just set up the mapping anyway.
 	// Permissions: kernel RW, user NONE
 	// Your code goes here:
+	// Use 4MB pages: no page tables needed, and far fewer TLB entries.
 	uint32_t four_gig = ~0;
 	boot_map_region(kern_pgdir, KERNBASE, four_gig - KERNBASE,
-			0x0, PTE_W | PTE_P);
+			0x0, PTE_W | PTE_PS | PTE_P);
 
 	// Initialize the SMP-related parts of the memory map
 	mem_init_mp();
@@ -270,7 +305,9 @@ mem_init(void)
 	//
 	// If the machine reboots at this point, you've probably set up your
 	// kern_pgdir wrong.
-	lcr3(PADDR(kern_pgdir));
+	lcr4(rcr4() | CR4_PSE | CR4_PGE);
+	load_pgdir(kern_pgdir);
+	buddy_limit = ~0;
 
 	check_page_free_list(0);
 
@@ -319,14 +356,179 @@ mem_init_mp(void)
 // --------------------------------------------------------------
 // Tracking of physical pages.
 // The 'pages' array has one 'struct PageInfo' entry per physical page.
-// Pages are reference counted, and free pages are kept on a linked list.
+// Pages are reference counted.  Free pages are managed by a buddy
+// allocator, with a small per-CPU cache in front of it for the common
+// single-page case.
 // --------------------------------------------------------------
 
+// Per-CPU page caches are refilled from and drained to the buddy
+// allocator PCP_BATCH pages at a time, and never grow past PCP_HIGH.
+#define PCP_BATCH	16
+#define PCP_HIGH	64
+
+// The pre-zeroed pool is topped up to ZERO_POOL_HIGH pages, at most
+// ZERO_POOL_BATCH pages each time a CPU goes idle.
+#define ZERO_POOL_HIGH	128
+#define ZERO_POOL_BATCH	16
+
+static void
+buddy_list_add(struct PageInfo *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_flags = PP_BUDDY;
+	pp->pp_prev = NULL;
+	pp->pp_link = free_area[order];
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp;
+	free_area[order] = pp;
+}
+
+static void
+buddy_list_del(struct PageInfo *pp, int order)
+{
+	if (pp->pp_prev)
+		pp->pp_prev->pp_link = pp->pp_link;
+	else
+		free_area[order] = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp->pp_prev;
+	pp->pp_link = NULL;
+	pp->pp_prev = NULL;
+	pp->pp_flags = 0;
+}
+
+//
+// Take a block of 2^order pages off the free lists, splitting a larger
+// block if needed.  Returns NULL if no block is large enough.
+// Caller holds buddy_lock.
 //
-// Initialize page structure and memory free list.
+static struct PageInfo *
+buddy_alloc(int order)
+{
+	struct PageInfo *pp = NULL;
+	int o;
+
+	for (o = order; o <= MAX_ORDER; o++) {
+		for (pp = free_area[o]; pp; pp = pp->pp_link)
+			if (page2pa(pp) < buddy_limit)
+				break;
+		if (pp)
+			break;
+	}
+	if (!pp)
+		return NULL;
+
+	buddy_list_del(pp, o);
+	// Give the upper halves back until the block is the right size
+	while (o > order) {
+		o--;
+		buddy_list_add(pp + (1 << o), o);
+	}
+	return pp;
+}
+
+//
+// Put a block of 2^order pages back on the free lists, merging it with
+// its buddy for as long as the buddy is free too.
+// Caller holds buddy_lock.
+//
+static void
+buddy_free(struct PageInfo *pp, int order)
+{
+	size_t pn = pp - pages, bn;
+
+	pp->pp_flags = 0;
+	for (; order < MAX_ORDER; order++) {
+		bn = pn ^ (1 << order);
+		if (bn >= npages || !(pages[bn].pp_flags & PP_BUDDY)
+		    || pages[bn].pp_order != order)
+			break;
+		buddy_list_del(&pages[bn], order);
+		pn &= bn;
+	}
+	buddy_list_add(&pages[pn], order);
+}
+
+//
+// Move up to PCP_BATCH pages from the buddy allocator to the page cache
+// of CPU 'c'.
+// Caller holds buddy_lock.
+//
+static void
+pcp_refill(struct CpuInfo *c)
+{
+	struct PageInfo *p;
+	int i;
+
+	for (i = 0; i < PCP_BATCH; i++) {
+		if (!(p = buddy_alloc(0)))
+			break;
+		p->pp_flags = PP_PCP;
+		p->pp_link = c->cpu_pcp;
+		c->cpu_pcp = p;
+		c->cpu_npcp++;
+	}
+}
+
+//
+// Give every CPU's page cache back to the buddy allocator, for an
+// allocation that would otherwise fail while pages sit in them.  The
+// caches are only touched under the big kernel lock, which the caller
+// holds, so the other CPUs cannot be using theirs.
+// Caller holds buddy_lock.
+//
+static void
+pcp_drain_all(void)
+{
+	struct CpuInfo *c;
+	struct PageInfo *p;
+
+	for (c = cpus; c < cpus + NCPU; c++)
+		while ((p = c->cpu_pcp) != NULL) {
+			c->cpu_pcp = p->pp_link;
+			c->cpu_npcp--;
+			p->pp_link = NULL;
+			buddy_free(p, 0);
+		}
+}
+
+//
+// Take a page off the pre-zeroed pool, or return NULL if it is empty.
+// Caller holds buddy_lock.
+//
+static struct PageInfo *
+zero_pool_take(void)
+{
+	struct PageInfo *p;
+
+	if ((p = zero_pool) != NULL) {
+		zero_pool = p->pp_link;
+		zero_pool_count--;
+		p->pp_link = NULL;
+		p->pp_flags = 0;
+	}
+	return p;
+}
+
+//
+// Give the whole pre-zeroed pool back to the buddy allocator, so that
+// its pages can merge into larger blocks again.
+// Caller holds buddy_lock.
+//
+static void
+zero_pool_drain(void)
+{
+	struct PageInfo *p;
+
+	while ((p = zero_pool_take()) != NULL)
+		buddy_free(p, 0);
+}
+
+//
+// Initialize page structure and memory free lists.
 // After this is done, NEVER use boot_alloc again.  ONLY use the page
 // allocator functions below to allocate and deallocate physical
-// memory via the page_free_list.
+// memory.
 //
 void
 page_init(void)
@@ -358,16 +560,13 @@ page_init(void)
 	// skip adding phys page 0 to free list
 	pages[0].pp_ref = 1;  // kernel references to that page
 
-	page_free_list = &pages[1];
-
 	// rest of base mem: free
-	for (i = 2; i < npages_basemem; i++) {
+	for (i = 1; i < npages_basemem; i++) {
 		// i == 7 -> 0x7000 (addr of MPENTRY_ADDR);
 		if (i == 7)
 			continue;
 		pages[i].pp_ref = 0;
-		pages[i].pp_link = page_free_list;
-		page_free_list = &pages[i];
+		buddy_free(&pages[i], 0);
 	}
 	// omit 640k - 1mb chunk (i/o hole)
 
@@ -380,8 +579,7 @@ page_init(void)
 	// 4mb till the end of phys mem: free
 	for (i = kernel_phys_page_end; i < npages; ++i) {
 		pages[i].pp_ref = 0;
-		pages[i].pp_link = page_free_list;
-		page_free_list = &pages[i];
+		buddy_free(&pages[i], 0);
 	}
 }
 
@@ -391,21 +589,45 @@ page_init(void)
 // count of the page - the caller must do these if necessary (either explicitly
 // or via page_insert).
 //
-// Be sure to set the pp_link field of the allocated page to NULL so
-// page_free can check for double-free bugs.
+// The page comes from this CPU's page cache, which is refilled from the
+// buddy allocator when it runs dry, and if that is empty too, from the
+// other CPUs' caches.  Zeroed pages come from the pre-zeroed pool when
+// it has any, and so do other pages once everything else is gone.
 //
 // Returns NULL if out of free memory.
 //
-// Hint: use page2kva and memset
 struct PageInfo *
 page_alloc(int alloc_flags)
 {
-	// Fill this function in
-	if (page_free_list == NULL)
-		return NULL;
-	struct PageInfo *p = page_free_list;
-	page_free_list = p->pp_link;
+	struct CpuInfo *c = thiscpu;
+	struct PageInfo *p;
+
+	if ((alloc_flags & ALLOC_ZERO) && zero_pool) {
+		spin_lock(&buddy_lock);
+		p = zero_pool_take();
+		spin_unlock(&buddy_lock);
+		if (p)
+			return p;
+	}
+
+	if (!c->cpu_pcp) {
+		spin_lock(&buddy_lock);
+		pcp_refill(c);
+		if (!c->cpu_pcp) {
+			pcp_drain_all();
+			pcp_refill(c);
+		}
+		p = c->cpu_pcp ? NULL : zero_pool_take();
+		spin_unlock(&buddy_lock);
+		if (!c->cpu_pcp)
+			return p;
+	}
+
+	p = c->cpu_pcp;
+	c->cpu_pcp = p->pp_link;
+	c->cpu_npcp--;
 	p->pp_link = NULL;
+	p->pp_flags = 0;
 
 	if (alloc_flags & ALLOC_ZERO)
 		memset(page2kva(p), '\0', PGSIZE);
@@ -413,19 +635,119 @@ page_alloc(int alloc_flags)
 }
 
 //
-// Return a page to the free list.
+// Return a page to this CPU's page cache, spilling part of the cache
+// back to the buddy allocator once it grows past PCP_HIGH pages.
 // (This function should only be called when pp->pp_ref reaches 0.)
 //
 void
 page_free(struct PageInfo *pp)
 {
-	// Fill this function in
-	// Hint: You may want to panic if pp->pp_ref is nonzero or
-	// pp->pp_link is not NULL.
-	if (pp->pp_ref != 0 || pp->pp_link != NULL)
+	struct CpuInfo *c = thiscpu;
+	int i;
+
+	if (pp->pp_ref != 0 || pp->pp_link != NULL || pp->pp_flags != 0)
 		panic("page is still in use.");
-	pp->pp_link = page_free_list;
-	page_free_list = pp;
+
+	// Another CPU may still reach the page until tlb_shootdown()
+	if (tlb_batch.cpumask) {
+		pp->pp_link = tlb_batch.free;
+		tlb_batch.free = pp;
+		return;
+	}
+
+	pp->pp_flags = PP_PCP;
+	pp->pp_link = c->cpu_pcp;
+	c->cpu_pcp = pp;
+
+	if (++c->cpu_npcp > PCP_HIGH) {
+		spin_lock(&buddy_lock);
+		for (i = 0; i < PCP_BATCH; i++) {
+			pp = c->cpu_pcp;
+			c->cpu_pcp = pp->pp_link;
+			c->cpu_npcp--;
+			pp->pp_link = NULL;
+			buddy_free(pp, 0);
+		}
+		spin_unlock(&buddy_lock);
+	}
+}
+
+//
+// Zero a few free pages into the pre-zeroed pool.  Called by CPUs about
+// to go idle, without the big kernel lock held, so the pages come
+// straight from the buddy allocator rather than the page caches.
+//
+void
+page_zero_pool_refill(void)
+{
+	struct PageInfo *p;
+	int i;
+
+	for (i = 0; i < ZERO_POOL_BATCH && zero_pool_count < ZERO_POOL_HIGH; i++) {
+		spin_lock(&buddy_lock);
+		p = buddy_alloc(0);
+		spin_unlock(&buddy_lock);
+		if (!p)
+			return;
+		memset(page2kva(p), '\0', PGSIZE);
+
+		spin_lock(&buddy_lock);
+		p->pp_flags = PP_ZERO;
+		p->pp_link = zero_pool;
+		zero_pool = p;
+		zero_pool_count++;
+		spin_unlock(&buddy_lock);
+	}
+}
+
+//
+// Allocates 2^order physically contiguous pages, aligned to their total
+// size, for DMA buffers and large mappings.  ALLOC_ZERO works as for
+// page_alloc.  Each page of the block starts out like a page from
+// page_alloc, so they may also be freed one by one with page_free.
+//
+// Returns NULL if no free block is large enough.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *pp;
+
+	assert(order >= 0 && order <= MAX_ORDER);
+	spin_lock(&buddy_lock);
+	if (!(pp = buddy_alloc(order))) {
+		// cached and pre-zeroed pages may complete a block once
+		// they are merged
+		pcp_drain_all();
+		zero_pool_drain();
+		pp = buddy_alloc(order);
+	}
+	spin_unlock(&buddy_lock);
+
+	if (pp && (alloc_flags & ALLOC_ZERO))
+		memset(page2kva(pp), '\0', PGSIZE << order);
+	return pp;
+}
+
+//
+// Return a block from page_alloc_order() to the buddy allocator.
+// Every page of the block must have a zero reference count.
+//
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	int i;
+
+	assert(order >= 0 && order <= MAX_ORDER);
+	assert(((pp - pages) & ((1 << order) - 1)) == 0);
+	for (i = 0; i < (1 << order); i++)
+		if (pp[i].pp_ref != 0 || pp[i].pp_link != NULL
+		    || pp[i].pp_flags != 0)
+			panic("page is still in use.");
+
+	spin_lock(&buddy_lock);
+	buddy_free(pp, order);
+	spin_unlock(&buddy_lock);
 }
 
 //
@@ -464,11 +786,16 @@ page_decref(struct PageInfo* pp)
 // kaddr - take phys addr and return virtual kernel addr (basically add KERNBASE)
 // YOu should fully understand what is going on and probably suggest a different
 // solution;
+//
+// A 4MB (PTE_PS) mapping has no page table, so pgdir_walk returns NULL
+// for any 'va' inside one, even if create is set.
 pte_t *
 pgdir_walk(pde_t *pgdir, const void *va, int create)
 {
 	struct PageInfo *p;
 	physaddr_t pa;
+	if (pgdir[PDX(va)] & PTE_PS)
+		return NULL;
 	if ((pgdir[PDX(va)] & PTE_AVAIL) == 0) {
 		if (!create)
 			return NULL;
@@ -500,6 +827,13 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 // above UTOP. As such, it should *not* change the pp_ref field on the
 // mapped pages.
 //
+// If perm includes PTE_PS, the region is mapped with 4MB pages instead:
+// va and pa must then be PTSIZE-aligned, and size is rounded up to a
+// multiple of PTSIZE.
+//
+// These mappings are the same in every address space, so they are made
+// global (PTE_G) and survive %cr3 reloads.
+//
 // Hint: the TA solution uses pgdir_walk
 static void
 boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm)
@@ -509,6 +843,15 @@ boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm
 	pte_t *pte;
 	assert(va >= UTOP);
 
+	perm |= PTE_G;
+
+	if (perm & PTE_PS) {
+		assert(va % PTSIZE == 0 && pa % PTSIZE == 0);
+		for (i = 0; i < size; i += PTSIZE)
+			pgdir[PDX(va + i)] = (pa + i) | perm | PTE_P;
+		return;
+	}
+
 	for (i = 0; i < size / PGSIZE; ++i, va += PGSIZE, pa += PGSIZE) {
 		pte = pgdir_walk(pgdir, (void *)va, 1);
 		*pte = pa | perm | PTE_P;
@@ -535,6 +878,7 @@ boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm
 // RETURNS:
 //   0 on success
 //   -E_NO_MEM, if page table couldn't be allocated
+//   -E_INVAL, if 'va' lies inside a 4MB mapping
 //
 // Hint: The TA solution is implemented using pgdir_walk, page_remove,
 // and page2pa.
@@ -543,6 +887,8 @@ int
 page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 {
 	// Fill this function in
+	if (pgdir[PDX(va)] & PTE_PS)
+		return -E_INVAL;
 	pte_t *pte = pgdir_walk(pgdir, va, 1);
 	if (!pte)
 		return -E_NO_MEM;
@@ -562,12 +908,21 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 //
 // Return NULL if there is no page mapped at va.
 //
+// Inside a 4MB mapping this returns the 4K page backing 'va', and the
+// "pte" stored is the page directory entry.
+//
 // Hint: the TA solution uses pgdir_walk and pa2page.
 //
 struct PageInfo *
 page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
 	// Fill this function in
+	if (pgdir[PDX(va)] & PTE_PS) {
+		if (pte_store)
+			*pte_store = &pgdir[PDX(va)];
+		return pa2page(PTE_ADDR(pgdir[PDX(va)])) + PTX(va);
+	}
+
 	pte_t *pte = pgdir_walk(pgdir, va, 0);
 	if (!pte || !(*pte))
 		return NULL;
@@ -590,6 +945,8 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 //   - The TLB must be invalidated if you remove an entry from
 //     the page table.
 //
+// If 'va' lies inside a 4MB mapping, the whole 4MB mapping is removed.
+//
 // Hint: The TA solution is implemented using page_lookup,
 // 	tlb_invalidate, and page_decref.
 //
@@ -599,25 +956,181 @@ page_remove(pde_t *pgdir, void *va)
 	// Fill this function in
 	pte_t *pte = NULL;
 	struct PageInfo *p = NULL;
+	int i;
+
+	if (pgdir[PDX(va)] & PTE_PS) {
+		p = pa2page(PTE_ADDR(pgdir[PDX(va)]));
+		pgdir[PDX(va)] = 0;
+		tlb_invalidate(pgdir, va);
+		for (i = 0; i < NPTENTRIES; i++)
+			page_decref(p + i);
+		return;
+	}
 
 	p = page_lookup(pgdir, va, &pte);
 	if (!pte || !p)
 		return;
-	page_decref(p);
 	*pte = 0;
 	tlb_invalidate(pgdir, va);
+	page_decref(p);
+}
+
+//
+// Map the block of PTSIZE_ORDER pages starting at 'pp' (as returned by
+// page_alloc_order) as one 4MB page at the PTSIZE-aligned address 'va',
+// with permissions 'perm|PTE_PS|PTE_P'.  Every page of the block has its
+// pp_ref incremented.
+//
+// A 4MB mapping already at 'va' is replaced.  An empty page table there
+// is freed; if 4K pages are still mapped in [va, va+PTSIZE) this fails.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL, if 4K pages are mapped in the way
+//
+int
+page_insert_large(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	pte_t *pt;
+	int i;
+
+	assert((uintptr_t) va % PTSIZE == 0);
+	assert((pp - pages) % NPTENTRIES == 0);
+
+	if ((*pde & PTE_P) && !(*pde & PTE_PS)) {
+		pt = (pte_t *) KADDR(PTE_ADDR(*pde));
+		for (i = 0; i < NPTENTRIES; i++)
+			if (pt[i] & PTE_P)
+				return -E_INVAL;
+		page_decref(pa2page(PTE_ADDR(*pde)));
+		*pde = 0;
+	}
+
+	// Take the new references first, in case 'pp' is already mapped here
+	for (i = 0; i < NPTENTRIES; i++)
+		pp[i].pp_ref++;
+	page_remove(pgdir, va);
+	*pde = page2pa(pp) | perm | PTE_PS | PTE_P;
+	tlb_invalidate(pgdir, va);
+	return 0;
 }
 
+// --------------------------------------------------------------
+// TLB shootdown.
+// Invalidations of a page directory that other CPUs have loaded are
+// collected in tlb_batch while the kernel works, and tlb_shootdown()
+// sends one IPI to each of those CPUs before the kernel returns to user
+// mode.  Pages freed in the meantime are held back until the flush, so
+// no CPU can reach them through a stale TLB entry once they are reused.
+// --------------------------------------------------------------
+
 //
 // Invalidate a TLB entry, but only if the page tables being
 // edited are the ones currently in use by the processor.
+// Other CPUs that have 'pgdir' loaded are queued for a shootdown.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
+	uint32_t mask = 0;
+	int i;
+
 	// Flush the entry only if we're modifying the current address space.
-	if (!curenv || curenv->env_pgdir == pgdir)
+	if (thiscpu->cpu_pgdir == pgdir)
 		invlpg(va);
+
+	for (i = 0; i < ncpu; i++)
+		if (&cpus[i] != thiscpu && cpus[i].cpu_pgdir == pgdir)
+			mask |= 1 << i;
+	if (!mask)
+		return;
+
+	if (!tlb_batch.cpumask)
+		tlb_batch.pgdir = pgdir;
+	tlb_batch.cpumask |= mask;
+	if (tlb_batch.pgdir != pgdir || tlb_batch.nva == TLB_BATCH_MAX)
+		tlb_batch.nva = -1;
+	if (tlb_batch.nva >= 0)
+		tlb_batch.va[tlb_batch.nva++] = (uintptr_t) va;
+}
+
+//
+// Make every CPU queued by tlb_invalidate() flush its TLB, then free
+// the pages that were held back.  Called with the big kernel lock held,
+// before the kernel returns to user mode or idles.
+//
+void
+tlb_shootdown(void)
+{
+	struct PageInfo *pp;
+	int i;
+
+	if (!tlb_batch.cpumask)
+		return;
+
+	tlb_batch.pending = tlb_batch.cpumask;
+	for (i = 0; i < ncpu; i++)
+		if (tlb_batch.cpumask & (1 << i))
+			lapic_ipi_cpu(cpus[i].cpu_id, T_TLBFLUSH);
+
+	// A CPU that trapped into the kernel meanwhile cannot take the IPI
+	// while it waits for the big kernel lock; it reloads %cr3 as soon
+	// as it gets the lock instead (see trap()).
+	for (i = 0; i < ncpu; i++)
+		while (tlb_batch.pending & (1 << i)) {
+			if (cpus[i].cpu_in_kernel) {
+				cpus[i].cpu_tlb_stale = 1;
+				__sync_fetch_and_and(&tlb_batch.pending, ~(1 << i));
+			} else
+				asm volatile("pause");
+		}
+
+	tlb_batch.cpumask = 0;
+	tlb_batch.nva = 0;
+	while ((pp = tlb_batch.free) != NULL) {
+		tlb_batch.free = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free(pp);
+	}
+}
+
+//
+// Handle a T_TLBFLUSH IPI.  Runs without the big kernel lock.
+//
+void
+tlb_shootdown_ack(void)
+{
+	struct CpuInfo *c = thiscpu;
+	uint32_t bit = 1 << (c - cpus);
+	int i;
+
+	if (tlb_batch.pending & bit) {
+		if (tlb_batch.nva >= 0 && tlb_batch.pgdir == c->cpu_pgdir)
+			for (i = 0; i < tlb_batch.nva; i++)
+				invlpg((void *) tlb_batch.va[i]);
+		else
+			lcr3(PADDR(c->cpu_pgdir));
+		__sync_fetch_and_and(&tlb_batch.pending, ~bit);
+	}
+	lapic_eoi();
+}
+
+//
+// Switch this CPU to the address space 'pgdir'.  Reloading %cr3 flushes
+// the TLB (except for the global kernel mappings), so it is skipped if
+// 'pgdir' is already loaded and nobody changed it from another CPU.
+//
+void
+load_pgdir(pde_t *pgdir)
+{
+	struct CpuInfo *c = thiscpu;
+
+	if (c->cpu_pgdir == pgdir && !c->cpu_tlb_stale)
+		return;
+	c->cpu_pgdir = pgdir;
+	c->cpu_tlb_stale = 0;
+	lcr3(PADDR(pgdir));
 }
 
 //
@@ -683,30 +1196,78 @@ static uintptr_t user_mem_check_addr;
 // Returns 0 if the user program can access this range of addresses,
 // and -E_FAULT otherwise.
 //
-// TODO: this needs to be refactored/fixed in order to pass faultnostack
+// Each page table page is looked up once, not once per page.
+//
 int
 user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 {
 	// LAB 3: Your code here.
-	// TODO: make it more efficient
-	int i;
-	pte_t *p;
-	for (i = 0; i < len; i++, va++) {
-		if ((uintptr_t)va > ULIM) {
-			user_mem_check_addr = (uintptr_t)va;
-			return -E_FAULT;
-		}
-		p = pgdir_walk(env->env_pgdir, va, 0);
-		if (!p) {
-			user_mem_check_addr = (uintptr_t)va;
-			return -E_FAULT;
-		}
-		if (!(*p & (PTE_P | perm))) {
-			user_mem_check_addr = (uintptr_t)va;
-			return -E_FAULT;
+	uintptr_t a = (uintptr_t) va, end = a + len;
+	uint32_t pdx = ~0;
+	pte_t *pt = NULL;
+	pde_t pde;
+
+	perm |= PTE_P;
+	// A range that wraps around is bound to cross ULIM
+	if (end < a)
+		end = ~0;
+
+	for (; a < end; a = ROUNDDOWN(a, PGSIZE) + PGSIZE) {
+		if (a >= ULIM)
+			goto bad;
+		pde = env->env_pgdir[PDX(a)];
+		if ((pde & perm) != perm)
+			goto bad;
+		if (pde & PTE_PS)
+			continue;
+		if (PDX(a) != pdx) {
+			pdx = PDX(a);
+			pt = (pte_t *) KADDR(PTE_ADDR(pde));
 		}
+		if ((pt[PTX(a)] & perm) != perm)
+			goto bad;
 	}
+	return 0;
+
+bad:
+	user_mem_check_addr = a;
+	return -E_FAULT;
+}
+
+//
+// Copy 'len' bytes from user address 'usrc' in the current address space
+// to 'dst' in the kernel (copy_from_user), or the other way around
+// (copy_to_user).  Only the bounds are checked up front: the page tables
+// are left to the MMU, and a fault on a missing or read-only user page
+// is caught through the exception table (see page_fault_handler), so a
+// copy is a single pass over memory.
+//
+// Returns 0 on success, -E_FAULT if some byte could not be accessed.
+// Part of the range may have been copied in that case.
+//
+int copy_user(void *dst, const void *src, size_t len);	// kern/usercopy.S
+
+static bool
+user_range_ok(const void *va, size_t len)
+{
+	uintptr_t a = (uintptr_t) va;
+
+	return a + len >= a && a + len <= ULIM;
+}
+
+int
+copy_from_user(void *dst, const void *usrc, size_t len)
+{
+	if (!user_range_ok(usrc, len) || copy_user(dst, usrc, len) < 0)
+		return -E_FAULT;
+	return 0;
+}
 
+int
+copy_to_user(void *udst, const void *src, size_t len)
+{
+	if (!user_range_ok(udst, len) || copy_user(udst, src, len) < 0)
+		return -E_FAULT;
 	return 0;
 }
 
@@ -733,61 +1294,140 @@ user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 // --------------------------------------------------------------
 
 //
-// Check that the pages on the page_free_list are reasonable.
+// Free list i of the allocator, for i in [0, CHECK_NLISTS): the buddy
+// free lists first, then each CPU's page cache, then the pre-zeroed
+// pool.  Sets *n to the number of pages in each block on that list.
+//
+#define CHECK_NLISTS	(MAX_ORDER + 1 + NCPU + 1)
+#define CHECK_ZERO_POOL	(CHECK_NLISTS - 1)
+
+static struct PageInfo *
+check_free_list(int i, int *n)
+{
+	if (i <= MAX_ORDER) {
+		*n = 1 << i;
+		return free_area[i];
+	}
+	*n = 1;
+	if (i == CHECK_ZERO_POOL)
+		return zero_pool;
+	return cpus[i - MAX_ORDER - 1].cpu_pcp;
+}
+
+static int
+check_count_free_pages(void)
+{
+	struct PageInfo *pp;
+	int i, n, nfree = 0;
+
+	for (i = 0; i < CHECK_NLISTS; i++)
+		for (pp = check_free_list(i, &n); pp; pp = pp->pp_link)
+			nfree += n;
+	return nfree;
+}
+
+// Free pages set aside by check_steal_free_pages().
+static struct PageInfo *stolen_area[MAX_ORDER + 1];
+static struct PageInfo *stolen_pcp, *stolen_zero_pool;
+static int stolen_npcp, stolen_zero_pool_count;
+
+//
+// Temporarily steal all free pages, so the allocator looks empty.
+//
+static void
+check_steal_free_pages(void)
+{
+	memmove(stolen_area, free_area, sizeof(free_area));
+	memset(free_area, 0, sizeof(free_area));
+	stolen_pcp = thiscpu->cpu_pcp;
+	stolen_npcp = thiscpu->cpu_npcp;
+	thiscpu->cpu_pcp = NULL;
+	thiscpu->cpu_npcp = 0;
+	stolen_zero_pool = zero_pool;
+	stolen_zero_pool_count = zero_pool_count;
+	zero_pool = NULL;
+	zero_pool_count = 0;
+}
+
+//
+// Give the pages taken by check_steal_free_pages() back.
+//
+static void
+check_return_free_pages(void)
+{
+	struct PageInfo **pp;
+	int i;
+
+	for (i = 0; i <= MAX_ORDER; i++) {
+		// Nothing may have spilled over to the buddy allocator
+		assert(!free_area[i]);
+		free_area[i] = stolen_area[i];
+	}
+	for (pp = &thiscpu->cpu_pcp; *pp; pp = &(*pp)->pp_link)
+		/* do nothing */;
+	*pp = stolen_pcp;
+	thiscpu->cpu_npcp += stolen_npcp;
+	assert(!zero_pool);
+	zero_pool = stolen_zero_pool;
+	zero_pool_count = stolen_zero_pool_count;
+}
+
+//
+// Check that the pages on the free lists are reasonable.
 //
 static void
 check_page_free_list(bool only_low_memory)
 {
-	struct PageInfo *pp;
+	struct PageInfo *blk, *pp;
 	unsigned pdx_limit = only_low_memory ? 1 : NPDENTRIES;
 	int nfree_basemem = 0, nfree_extmem = 0;
+	int i, n;
 	char *first_free_page;
 
-	if (!page_free_list)
-		panic("'page_free_list' is a null pointer!");
-
-	if (only_low_memory) {
-		// Move pages with lower addresses first in the free
-		// list, since entry_pgdir does not map all pages.
-		struct PageInfo *pp1, *pp2;
-		struct PageInfo **tp[2] = { &pp1, &pp2 };
-		for (pp = page_free_list; pp; pp = pp->pp_link) {
-			int pagetype = PDX(page2pa(pp)) >= pdx_limit;
-			*tp[pagetype] = pp;
-			tp[pagetype] = &pp->pp_link;
-		}
-		*tp[1] = 0;
-		*tp[0] = pp2;
-		page_free_list = pp1;
-	}
+	if (!check_count_free_pages())
+		panic("no free pages!");
 
 	// if there's a page that shouldn't be on the free list,
 	// try to make sure it eventually causes trouble.
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		if (PDX(page2pa(pp)) < pdx_limit)
-			memset(page2kva(pp), 0x97, 128);
+	// (Pages in the pre-zeroed pool must stay zero.)
+	for (i = 0; i < CHECK_ZERO_POOL; i++)
+		for (blk = check_free_list(i, &n); blk; blk = blk->pp_link)
+			for (pp = blk; pp < blk + n; pp++)
+				if (PDX(page2pa(pp)) < pdx_limit)
+					memset(page2kva(pp), 0x97, 128);
 
 	first_free_page = (char *) boot_alloc(0);
-	for (pp = page_free_list; pp; pp = pp->pp_link) {
-		// check that we didn't corrupt the free list itself
-		assert(pp >= pages);
-		assert(pp < pages + npages);
-		assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
-
-		// check a few pages that shouldn't be on the free list
-		assert(page2pa(pp) != 0);
-		assert(page2pa(pp) != IOPHYSMEM);
-		assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
-		assert(page2pa(pp) != EXTPHYSMEM);
-		assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
-		// (new test for lab 4)
-		assert(page2pa(pp) != MPENTRY_PADDR);
-
-		if (page2pa(pp) < EXTPHYSMEM)
-			++nfree_basemem;
-		else
-			++nfree_extmem;
-	}
+	for (i = 0; i < CHECK_NLISTS; i++)
+		for (blk = check_free_list(i, &n); blk; blk = blk->pp_link) {
+			// check that we didn't corrupt the free list itself
+			assert(blk >= pages);
+			assert(blk + n <= pages + npages);
+			assert(((char *) blk - (char *) pages) % sizeof(*blk) == 0);
+			assert(((blk - pages) & (n - 1)) == 0);
+			if (i <= MAX_ORDER)
+				assert(blk->pp_flags == PP_BUDDY && blk->pp_order == i);
+			else if (i == CHECK_ZERO_POOL)
+				assert(blk->pp_flags == PP_ZERO);
+			else
+				assert(blk->pp_flags == PP_PCP);
+
+			for (pp = blk; pp < blk + n; pp++) {
+				// check a few pages that shouldn't be on the free list
+				assert(page2pa(pp) != 0);
+				assert(page2pa(pp) != IOPHYSMEM);
+				assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
+				assert(page2pa(pp) != EXTPHYSMEM);
+				assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
+				// (new test for lab 4)
+				assert(page2pa(pp) != MPENTRY_PADDR);
+				assert(pp->pp_ref == 0);
+
+				if (page2pa(pp) < EXTPHYSMEM)
+					++nfree_basemem;
+				else
+					++nfree_extmem;
+			}
+		}
 
 	assert(nfree_basemem > 0);
 	assert(nfree_extmem > 0);
@@ -802,7 +1442,6 @@ check_page_alloc(void)
 {
 	struct PageInfo *pp, *pp0, *pp1, *pp2;
 	int nfree;
-	struct PageInfo *fl;
 	char *c;
 	int i;
 
@@ -810,8 +1449,7 @@ check_page_alloc(void)
 		panic("'pages' is a null pointer!");
 
 	// check number of free pages
-	for (pp = page_free_list, nfree = 0; pp; pp = pp->pp_link)
-		++nfree;
+	nfree = check_count_free_pages();
 
 	// should be able to allocate three pages
 	pp0 = pp1 = pp2 = 0;
@@ -827,8 +1465,7 @@ check_page_alloc(void)
 	assert(page2pa(pp2) < npages*PGSIZE);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	check_steal_free_pages();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -856,7 +1493,7 @@ check_page_alloc(void)
 		assert(c[i] == 0);
 
 	// give free list back
-	page_free_list = fl;
+	check_return_free_pages();
 
 	// free the pages we took
 	page_free(pp0);
@@ -864,9 +1501,7 @@ check_page_alloc(void)
 	page_free(pp2);
 
 	// number of free pages should be the same
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		--nfree;
-	assert(nfree == 0);
+	assert(nfree == check_count_free_pages());
 
 	cprintf("check_page_alloc() succeeded!\n");
 }
@@ -950,6 +1585,8 @@ check_va2pa(pde_t *pgdir, uintptr_t va)
 		return ~0;
 
     }
+	if (*pgdir & PTE_PS)
+		return PTE_ADDR(*pgdir) + PTX(va) * PGSIZE;
 	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
 	if (!(p[PTX(va)] & PTE_P)) {
 		return ~0;
@@ -963,7 +1600,6 @@ static void
 check_page(void)
 {
 	struct PageInfo *pp, *pp0, *pp1, *pp2;
-	struct PageInfo *fl;
 	pte_t *ptep, *ptep1;
 	void *va;
 	uintptr_t mm1, mm2;
@@ -981,8 +1617,7 @@ check_page(void)
 	assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	check_steal_free_pages();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -1102,7 +1737,7 @@ check_page(void)
 	pp0->pp_ref = 0;
 
 	// give free list back
-	page_free_list = fl;
+	check_return_free_pages();
 
 	// free the pages we took
 	page_free(pp0);
@@ -1141,7 +1776,6 @@ static void
 check_page_installed_pgdir(void)
 {
 	struct PageInfo *pp, *pp0, *pp1, *pp2;
-	struct PageInfo *fl;
 	pte_t *ptep, *ptep1;
 	uintptr_t va;
 	int i;
@@ -53,20 +53,34 @@ enum {
 
 void	mem_init(void);
 
+// Order of the page blocks backing 4MB (PTE_PS) mappings.
+#define PTSIZE_ORDER	10
+// Largest block the buddy allocator hands out: 2^MAX_ORDER pages (4MB).
+#define MAX_ORDER	PTSIZE_ORDER
+
 void	page_init(void);
 struct PageInfo *page_alloc(int alloc_flags);
 void	page_free(struct PageInfo *pp);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void	page_free_order(struct PageInfo *pp, int order);
+void	page_zero_pool_refill(void);
 int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
+int	page_insert_large(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
+void	tlb_shootdown(void);
+void	tlb_shootdown_ack(void);
+void	load_pgdir(pde_t *pgdir);
 
 void *	mmio_map_region(physaddr_t pa, size_t size);
 
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
+int	copy_from_user(void *dst, const void *usrc, size_t len);
+int	copy_to_user(void *udst, const void *src, size_t len);
 
 static inline physaddr_t
 page2pa(struct PageInfo *pp)
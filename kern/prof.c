@@ -0,0 +1,181 @@
+// Sampling profiler driven by the LAPIC timer.
+//
+// Each timer interrupt appends one sample to the ring of the CPU that
+// took it.  Since the kernel runs with interrupts disabled, kernel
+// samples only ever land in the idle loop; time spent in system calls
+// shows up on the user instruction following the trap.  The host
+// script prof-report symbolizes a dump and builds flat profiles or
+// folded stacks for flame graphs.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/string.h>
+
+#include <kern/prof.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+
+// Each CPU's ring is 2^PROF_RING_ORDER pages, allocated on first use
+#define PROF_RING_ORDER	3
+#define PROF_NSAMPLES	((PGSIZE << PROF_RING_ORDER) / sizeof(struct ProfSample))
+
+// Rings are only touched with the big kernel lock held.
+struct ProfRing {
+	struct ProfSample *pr_samples;
+	uint32_t pr_head;		// Oldest unread sample
+	uint32_t pr_count;		// Number of unread samples
+	uint32_t pr_dropped;		// Samples lost to a full ring
+};
+
+static struct ProfRing prof_rings[NCPU];
+static bool prof_enabled;
+
+//
+// Discard all samples and start sampling on every CPU.
+// Returns 0, or -E_NO_MEM if a ring could not be allocated.
+//
+int
+prof_start(void)
+{
+	struct ProfRing *r;
+	struct PageInfo *pp;
+
+	for (r = prof_rings; r < prof_rings + ncpu; r++) {
+		if (!r->pr_samples) {
+			if (!(pp = page_alloc_order(PROF_RING_ORDER, 0)))
+				return -E_NO_MEM;
+			r->pr_samples = page2kva(pp);
+		}
+		r->pr_head = r->pr_count = r->pr_dropped = 0;
+	}
+	prof_enabled = 1;
+	return 0;
+}
+
+void
+prof_stop(void)
+{
+	prof_enabled = 0;
+}
+
+// Follow the %ebp chain starting at 'ebp', storing return addresses
+// into s->ps_pc.  User frames are read with copy_from_user, so a
+// corrupt user stack just ends the walk.
+static void
+prof_walk(struct ProfSample *s, uint32_t ebp)
+{
+	uintptr_t kstacktop = KSTACKTOP - cpunum() * (KSTKSIZE + KSTKGAP);
+	uint32_t frame[2];
+
+	while (ebp && s->ps_depth < PROF_DEPTH) {
+		if (s->ps_user) {
+			if (copy_from_user(frame, (void *) ebp, sizeof(frame)) < 0)
+				break;
+		} else {
+			if (ebp < kstacktop - KSTKSIZE
+			    || ebp + sizeof(frame) > kstacktop)
+				break;
+			memcpy(frame, (void *) ebp, sizeof(frame));
+		}
+		if (!frame[1])
+			break;
+		s->ps_pc[s->ps_depth++] = frame[1];
+		// Stacks grow down, so callers' frames are at higher addresses
+		if (frame[0] <= ebp)
+			break;
+		ebp = frame[0];
+	}
+}
+
+//
+// Record where the CPU was when timer interrupt 'tf' arrived.
+//
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfRing *r = &prof_rings[cpunum()];
+	struct ProfSample *s;
+
+	if (!prof_enabled)
+		return;
+	if (r->pr_count == PROF_NSAMPLES) {
+		r->pr_dropped++;
+		return;
+	}
+	s = &r->pr_samples[(r->pr_head + r->pr_count) % PROF_NSAMPLES];
+	s->ps_envid = curenv ? curenv->env_id : 0;
+	s->ps_envtype = curenv ? curenv->env_type : ENV_TYPE_USER;
+	s->ps_cpu = cpunum();
+	s->ps_user = (tf->tf_cs & 3) == 3;
+	s->ps_depth = 1;
+	s->ps_pc[0] = tf->tf_eip;
+	prof_walk(s, tf->tf_regs.reg_ebp);
+	r->pr_count++;
+}
+
+// Return a ring with unread samples, or NULL if all are empty.
+// Its oldest sample stays in place until prof_pop().
+static struct ProfRing *
+prof_peek(void)
+{
+	struct ProfRing *r;
+
+	for (r = prof_rings; r < prof_rings + ncpu; r++)
+		if (r->pr_count)
+			return r;
+	return NULL;
+}
+
+static void
+prof_pop(struct ProfRing *r)
+{
+	r->pr_head = (r->pr_head + 1) % PROF_NSAMPLES;
+	r->pr_count--;
+}
+
+//
+// Move up to 'n' samples into the user buffer 'buf'.
+// Returns the number of samples moved, or -E_FAULT if 'buf' is bad.
+//
+int
+prof_read(struct ProfSample *buf, size_t n)
+{
+	struct ProfRing *r;
+	int i;
+
+	for (i = 0; i < n && (r = prof_peek()); i++) {
+		if (copy_to_user(&buf[i], &r->pr_samples[r->pr_head],
+				 sizeof(*buf)) < 0)
+			return -E_FAULT;
+		prof_pop(r);
+	}
+	return i;
+}
+
+//
+// Print and drain all samples in the format prof-report expects:
+//	prof <cpu> <envid> <envtype> <u|k> <pc> <return address>...
+//
+void
+prof_print(void)
+{
+	struct ProfRing *r;
+	struct ProfSample *s;
+	int i;
+
+	while ((r = prof_peek())) {
+		s = &r->pr_samples[r->pr_head];
+		cprintf("prof %d %08x %d %c", s->ps_cpu, s->ps_envid,
+			s->ps_envtype, s->ps_user ? 'u' : 'k');
+		for (i = 0; i < s->ps_depth; i++)
+			cprintf(" %08x", s->ps_pc[i]);
+		cprintf("\n");
+		prof_pop(r);
+	}
+	for (r = prof_rings; r < prof_rings + ncpu; r++)
+		if (r->pr_dropped)
+			cprintf("prof: CPU %d dropped %u samples\n",
+				r - prof_rings, r->pr_dropped);
+}
@@ -0,0 +1,20 @@
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/prof.h>
+
+struct Trapframe;
+
+// Sampling profiler.  Every LAPIC timer interrupt records where the
+// CPU was into a per-CPU ring; the rings are drained by sys_prof() or
+// by the "prof" monitor command.
+int prof_start(void);
+void prof_stop(void);
+int prof_read(struct ProfSample *buf, size_t n);
+void prof_sample(struct Trapframe *tf);
+void prof_print(void);
+
+#endif /* JOS_KERN_PROF_H */
@@ -4,9 +4,28 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/timer.h>
+#include <kern/fpu.h>
+#include <kern/sysstat.h>
 
 void sched_halt(void);
 
+// CPU each env is bound to by sched_bind(), plus one; 0 lets it run
+// anywhere (indexed by ENVX)
+static uint8_t env_cpu[NENV];
+
+// may env 'e' run on this CPU?  An env bound to a CPU that is halted
+// runs wherever it can: nothing would wake that CPU before its next
+// timer tick.
+static bool
+sched_allowed(struct Env *e)
+{
+	int cpu = env_cpu[ENVX(e->env_id)];
+
+	return !cpu || cpu - 1 == cpunum()
+		|| cpus[cpu - 1].cpu_status == CPU_HALTED;
+}
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
@@ -33,22 +52,27 @@ sched_yield(void)
 	// below to halt the cpu.
 
 	// LAB 4: Your code here.
+	//
+	// An env bound to a CPU with sched_bind runs there while that
+	// CPU is awake.
 	for (; i < NENV; i++) {
-		if (envs[i].env_status == ENV_RUNNABLE)
+		if (envs[i].env_status == ENV_RUNNABLE &&
+		    sched_allowed(&envs[i]))
 			env_run(&envs[i]);
 	}
 	for (i = 0; i <= j; i++) {
-		if (envs[i].env_status == ENV_RUNNABLE)
+		if (envs[i].env_status == ENV_RUNNABLE &&
+		    sched_allowed(&envs[i]))
 			env_run(&envs[i]);
 	}
-	if (idle && idle->env_status == ENV_RUNNING)
+	if (idle && idle->env_status == ENV_RUNNING && sched_allowed(idle))
 		env_run(idle);
 
 	// give a try for net recving environment; note that it has
 	// the lowest priority amongst all the cases, which is good;
 	// i don't like this way of resolving rx irqs problems, though;
 	for (i = 0; i < NENV; i++) {
-		if (envs[i].env_net_recving) {
+		if (envs[i].env_net_recving && sched_allowed(&envs[i])) {
 			envs[i].env_net_recving = 0;
 			envs[i].env_net_value = 0;
 			envs[i].env_tf.tf_regs.reg_eax = 0;
@@ -60,6 +84,22 @@ sched_yield(void)
 	sched_halt();
 }
 
+// Run env 'e' on CPU 'cpu' from now on, or anywhere if 'cpu' is
+// negative.  If 'e' is running elsewhere, it moves at its next yield.
+// While 'cpu' is halted, the other CPUs may run 'e' instead.
+void
+sched_bind(struct Env *e, int cpu)
+{
+	env_cpu[ENVX(e->env_id)] = cpu < 0 ? 0 : cpu + 1;
+}
+
+// Forget the binding of env 'e', which is being freed.
+void
+sched_env_free(struct Env *e)
+{
+	env_cpu[ENVX(e->env_id)] = 0;
+}
+
 // Halt this CPU when there is nothing to do. Wait until the
 // timer interrupt wakes it up. This function never returns.
 //
@@ -80,7 +120,8 @@ sched_halt(void)
 		     envs[i].env_status == ENV_DYING))
 			break;
 	}
-	if (i == NENV) {
+	// Sleeping environments will be woken by the timer interrupt.
+	if (i == NENV && !timer_pending()) {
 
 		cprintf("No runnable environments in the system!\n");
 		while (1)
@@ -88,8 +129,9 @@ sched_halt(void)
 	}
 
 	// Mark that no environment is running on this CPU
+	fpu_release();
 	curenv = NULL;
-	lcr3(PADDR(kern_pgdir));
+	load_pgdir(kern_pgdir);
 
 	// Mark that this CPU is in the HALT state, so that when
 	// timer interupts come in, we know we should re-acquire the
@@ -97,8 +139,14 @@ sched_halt(void)
 	xchg(&thiscpu->cpu_status, CPU_HALTED);
 
 	// Release the big kernel lock as if we were "leaving" the kernel
+	tlb_shootdown();
+	sysstat_exit();
+	thiscpu->cpu_in_kernel = 0;
 	unlock_kernel();
 
+	// Use the idle time to zero pages for page_alloc(ALLOC_ZERO)
+	page_zero_pool_refill();
+
 	// Reset stack pointer, enable interrupts and then halt.
 	asm volatile (
 		"movl $0, %%ebp\n"
@@ -6,7 +6,11 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+struct Env;
+
 // This function does not return.
 void sched_yield(void) __attribute__((noreturn));
+void sched_bind(struct Env *e, int cpu);
+void sched_env_free(struct Env *e);
 
 #endif	// !JOS_KERN_SCHED_H
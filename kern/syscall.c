@@ -11,6 +11,11 @@
 #include <kern/console.h>
 #include <kern/sched.h>
 #include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/fpu.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
+#include <kern/sysstat.h>
 #include <kern/e1000.h>
 
 // Print a string to the system console.
@@ -92,6 +97,10 @@ sys_exofork(void)
 	}
 	e->env_status = ENV_NOT_RUNNABLE;
 	memcpy(&e->env_tf, &thiscpu->cpu_env->env_tf, sizeof(e->env_tf));
+	if ((ret = fpu_fork(e, curenv)) < 0) {
+		env_free(e);
+		return ret;
+	}
 	// eax holds return value; newly created child will return 0
 	e->env_tf.tf_regs.reg_eax = 0;
 	return e->env_id;
@@ -180,14 +189,43 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 //
 // perm -- PTE_U | PTE_P must be set, PTE_AVAIL | PTE_W may or may not be set,
 //         but no other bits may be set.  See PTE_SYSCALL in inc/mmu.h.
+//         PTE_PS may also be set to allocate a single 4MB page instead,
+//         in which case va must be PTSIZE-aligned.
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
 //	-E_INVAL if va >= UTOP, or va is not page-aligned.
 //	-E_INVAL if perm is inappropriate (see above).
+//	-E_INVAL if perm has PTE_PS and 4K pages are mapped in the
+//		4MB region at va.
 //	-E_NO_MEM if there's no memory to allocate the new page,
 //		or to allocate any necessary page tables.
+static int
+sys_page_alloc_large(envid_t envid, void *va, int perm)
+{
+	struct PageInfo *p;
+	struct Env *e;
+	int ret;
+
+	if ((uint32_t)va >= UTOP || (uint32_t)va % PTSIZE != 0)
+		return -E_INVAL;
+
+	ret = envid2env(envid, &e, 1);
+	if (ret < 0)
+		return ret;
+
+	if (!(p = page_alloc_order(PTSIZE_ORDER, ALLOC_ZERO)))
+		return -E_NO_MEM;
+
+	ret = page_insert_large(e->env_pgdir, p, va, perm);
+	if (ret < 0) {
+		page_free_order(p, PTSIZE_ORDER);
+		return ret;
+	}
+	return 0;
+}
+
 static int
 sys_page_alloc(envid_t envid, void *va, int perm)
 {
@@ -200,11 +238,14 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 
 	// LAB 4: Your code here.
 	// create mask by flipping bits, so bits not allowed == 1
-	int mask = ~(PTE_U | PTE_P | PTE_AVAIL | PTE_W);
+	int mask = ~(PTE_U | PTE_P | PTE_AVAIL | PTE_W | PTE_PS);
 	if (!(perm & (PTE_U | PTE_P)) || (mask & perm)) {
 		return -E_INVAL;
 	}
 
+	if (perm & PTE_PS)
+		return sys_page_alloc_large(envid, va, perm & ~PTE_PS);
+
 	if ((uint32_t)va >= UTOP || (uint32_t)va % PGSIZE != 0) {
 		return -E_INVAL;
 	}
@@ -249,6 +290,11 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 //		address space.
 //	-E_NO_MEM if there's no memory to allocate any necessary page tables.
 //
+// If perm has PTE_PS, the whole 4MB page at srcva is mapped at dstva;
+// both must then be PTSIZE-aligned, and -E_INVAL is also returned if
+// srcva is not in a 4MB page or 4K pages are mapped in the way at dstva.
+// Without PTE_PS, a single 4K page of a 4MB page can be mapped.
+//
 //	TODO: after finishing lab6 refactor this function (and any other
 //	      funcs that are defined here;
 static int
@@ -267,7 +313,7 @@ sys_page_map(envid_t srcenvid, void *srcva,
 	// page_insert does the actual page mapping
 	uint32_t src = (uint32_t)srcva;
 	uint32_t dst = (uint32_t)dstva;
-	int mask = ~(PTE_U | PTE_P | PTE_AVAIL | PTE_W);
+	int mask = ~(PTE_U | PTE_P | PTE_AVAIL | PTE_W | PTE_PS);
 	int ret = -1;
 	bool write_perm = perm & PTE_W;
 	struct Env *srcenv, *dstenv;
@@ -282,6 +328,9 @@ sys_page_map(envid_t srcenvid, void *srcva,
 	    (uint32_t)src >= UTOP || (uint32_t)dst >= UTOP) {
 		return -E_INVAL;
 	}
+	if ((perm & PTE_PS) && (src % PTSIZE != 0 || dst % PTSIZE != 0)) {
+		return -E_INVAL;
+	}
 
 	ret = envid2env(srcenvid, &srcenv, 0);
 	if (ret < 0) {
@@ -302,6 +351,13 @@ sys_page_map(envid_t srcenvid, void *srcva,
 		 return -E_INVAL;
 	 }
 
+	if (perm & PTE_PS) {
+		if (!(*pte & PTE_PS))
+			return -E_INVAL;
+		return page_insert_large(dstenv->env_pgdir, p, dstva,
+					 perm & ~PTE_PS);
+	}
+
 	ret = page_insert(dstenv->env_pgdir, p, dstva, perm);
 	if (ret < 0) {
 		return ret;
@@ -311,6 +367,7 @@ sys_page_map(envid_t srcenvid, void *srcva,
 
 // Unmap the page of memory at 'va' in the address space of 'envid'.
 // If no page is mapped, the function silently succeeds.
+// If 'va' is inside a 4MB page, the whole 4MB page is unmapped.
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -382,6 +439,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 	pte_t *src_page;
 	bool transfer_page = false;
 
+	TRACE(TRACE_IPC_SEND, envid, value);
 	ret = envid2env(envid, &receiver, 0);
 	if (ret != 0)
 		return ret;  // bad_env
@@ -411,6 +469,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 			return ret;
 	} else
 		receiver->env_ipc_perm = 0;
+	timer_env_cancel(receiver);
 	receiver->env_status = ENV_RUNNABLE;
 	receiver->env_tf.tf_regs.reg_eax = 0;
 	return 0;
@@ -423,16 +482,23 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
+// If 'deadline' is nonzero, give up once time_msec() reaches it.
+//
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_TIMEOUT if nothing was received before 'deadline'.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, unsigned int deadline)
 {
 	// LAB 4: Your code here.
 	bool recv_pg = false;
 
+	TRACE(TRACE_IPC_RECV, dstva, deadline);
+	// an interrupt of the card this env drives may be waiting already
+	if (nic_ipc_pending(curenv))
+		return 0;
 	if ((uintptr_t)dstva < UTOP) {
 		if ((uintptr_t)dstva % PGSIZE != 0)
 			return -E_INVAL;
@@ -445,45 +511,66 @@ sys_ipc_recv(void *dstva)
 	curenv->env_ipc_dstva = recv_pg ? dstva : NULL;
 	curenv->env_ipc_recving = 1;
 	curenv->env_status = ENV_NOT_RUNNABLE;
+	if (deadline)
+		timer_env_sleep(curenv, deadline);
 	sys_yield();  // giving up CPU
 
 	return 0;
 }
 
+// Transmit the 'nbytes'-byte frame at 'data'.  A frame shorter than
+// TX_COPYBREAK bytes is copied.  A longer one is sent without a copy
+// from each page it touches, so it must not be changed until the card
+// is done with it (the pages themselves stay pinned until then even if
+// they are unmapped).
+// Returns -E_AGAIN if the tx ring is full; see sys_tx_wait.
 static int
-sys_tx_data(const char *data, uint8_t nbytes)
+sys_tx_data(const char *data, size_t nbytes)
 {
-	bool finished = false;
-	int ret;
-
 	if ((uintptr_t)data >= UTOP)
 		return -E_INVAL;
+	return tx_pkt(data, nbytes);
+}
 
-	while (!finished) {
-		ret = tx_pkt(data, nbytes);
-		switch (ret) {
-		case 0:
-			finished = true;
-			break;
-		case -E_INVAL:
-			panic("sys_tx_data: nbytes >= 1518 (eth pkt size)");
-			break;
-		case -E_E1000_NOT_TX:
-			continue;
-		}
-	}
+// Queue up to 'n' frames, laid out as consecutive struct jif_pkt
+// records (see JIF_PKT_NEXT) starting at 'pkts', and hand them to the
+// card together.  Frames are sent as by sys_tx_data.  Returns the
+// number queued, which is less than 'n' if the ring filled up, or
+// -E_AGAIN if it was full to begin with.
+static int
+sys_tx_batch(const struct jif_pkt *pkts, int n)
+{
+	if ((uintptr_t)pkts >= UTOP || n <= 0)
+		return -E_INVAL;
+	return tx_pkt_batch(pkts, n);
+}
+
+// Block until the card has sent some frames, if the tx ring is full.
+// Returns 0 once there may be room; callers retry their send.
+static int
+sys_tx_wait(void)
+{
+	if (tx_wait(curenv) == 0)
+		return 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sys_yield();
 	return 0;
 }
 
+// Wait in rx_pkt() for up to 'batch' packets at 'addr', or for one
+// packet if 'batch' is 0.
 static int
-sys_rx_data(void *addr)
+net_recv(void *addr, int batch)
 {
+	int r;
+
 	curenv->env_net_dstva = addr;
+	curenv->env_net_batch = batch;
 	// if there was something to receive, then we are good to
 	// go with returning the env_net_value, which holds the number
-	// of bytes copied onto VA addr;
-	if (rx_pkt(curenv) != -E_E1000_NOT_RX)
-		return curenv->env_net_value;
+	// of bytes or packets received;
+	if ((r = rx_pkt(curenv)) != -E_E1000_NOT_RX)
+		return r;
 	// otherwise, mark environment as the one that waits for packet
 	// receival and give up the CPU;
 	curenv->env_status = ENV_NOT_RUNNABLE;
@@ -492,6 +579,76 @@ sys_rx_data(void *addr)
 	return 0;
 }
 
+// Receive a packet.  The page at 'addr', which must be page-aligned,
+// is replaced with the driver's receive page, holding the packet as a
+// struct jif_pkt.  Returns the packet length.  Packets too long for a
+// page (JIF_PKT_PAGES) are dropped; use sys_rx_batch for those.
+static int
+sys_rx_data(void *addr)
+{
+	if ((uintptr_t) addr >= UTOP || PGOFF(addr))
+		return -E_INVAL;
+	return net_recv(addr, 0);
+}
+
+// Receive packets into up to 'n' pages, blocking until there is at
+// least one.  They replace the pages from 'va' on, as in sys_rx_data,
+// each packet starting on a page of its own and taking JIF_PKT_PAGES
+// of them.  Returns the number of packets.
+static int
+sys_rx_batch(void *va, int n)
+{
+	if ((uintptr_t) va >= UTOP || PGOFF(va) || n <= 0
+	    || n > (UTOP - (uintptr_t) va) / PGSIZE)
+		return -E_INVAL;
+	return net_recv(va, n);
+}
+
+// Receive from queue 'q' of the driver's receive queues from now on,
+// and run on CPU q % ncpu while it is awake, so that each queue is
+// processed on a CPU of its own.  Returns the number of queues; a negative 'q' just
+// asks for that.
+static int
+sys_rx_bind(int q)
+{
+	int r;
+
+	if ((r = rx_bind(curenv, q)) < 0 || q < 0)
+		return r;
+	sched_bind(curenv, q % ncpu);
+	// move there now if this is the wrong CPU
+	if (q % ncpu != cpunum()) {
+		curenv->env_status = ENV_RUNNABLE;
+		curenv->env_tf.tf_regs.reg_eax = r;
+		sched_yield();
+	}
+	return r;
+}
+
+// Take the e1000 over from the kernel's driver: map its rings and
+// buffers at 'va' (see inc/nicring.h) until this env exits.  The card's
+// interrupts then arrive as IPCs of 'value' from envid 0, delivered at
+// the next sys_ipc_recv if the env is not waiting in one.  Only the
+// network server may do this, and only one env at a time.
+static int
+sys_nic_map(void *va, uint32_t value)
+{
+	if ((uintptr_t) va >= UTOP || PGOFF(va)
+	    || NIC_MAP_PAGES > (UTOP - (uintptr_t) va) / PGSIZE)
+		return -E_INVAL;
+	if (curenv->env_type != ENV_TYPE_NS)
+		return -E_BAD_ENV;
+	return nic_map(curenv, va, value);
+}
+
+// Move the ring tails of the card this env took over with sys_nic_map
+// to 'rdt' and 'tdt', handing it the descriptors in between.
+static int
+sys_nic_kick(int rdt, int tdt)
+{
+	return nic_kick(curenv, rdt, tdt);
+}
+
 // Return the current time.
 static int
 sys_time_msec(void)
@@ -500,6 +657,59 @@ sys_time_msec(void)
 	return time_msec();
 }
 
+// Block until time_msec() reaches 'msec'.
+// The environment is off the run queue until then; the timer wheel
+// makes it runnable again.  Always returns 0.
+static int
+sys_sleep_until(unsigned int msec)
+{
+	if (msec <= time_msec())
+		return 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	timer_env_sleep(curenv, msec);
+	sys_yield();
+	return 0;
+}
+
+// Control the sampling profiler.  'cmd' is one of
+//	PROF_START: discard old samples and start sampling; returns 0.
+//	PROF_STOP: stop sampling; returns 0.
+//	PROF_READ: move up to 'n' samples into 'buf'; returns how many.
+//
+// Errors are:
+//	-E_NO_MEM if PROF_START could not allocate the sample rings.
+//	-E_FAULT if 'buf' is not writable user memory.
+//	-E_INVAL if 'cmd' is not valid.
+static int
+sys_prof(int cmd, struct ProfSample *buf, size_t n)
+{
+	switch (cmd) {
+	case PROF_START:
+		return prof_start();
+	case PROF_STOP:
+		prof_stop();
+		return 0;
+	case PROF_READ:
+		return prof_read(buf, n);
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Copy the per-syscall statistics of 'envid' (0 for the current env,
+// SYSSTAT_GLOBAL for the whole system) into 'buf', which must hold
+// NSYSCALLS entries.  If 'reset' is set, clear them afterwards.
+// Any environment may read any other's statistics.
+//
+// Returns NSYSCALLS on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_FAULT if 'buf' is not writable user memory.
+static int
+sys_stats(envid_t envid, struct SysStat *buf, bool reset)
+{
+	return sysstat_read(envid, buf, reset);
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -510,6 +720,7 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	int32_t ret = 0;
 	if (syscallno >= NSYSCALLS)
 		return -E_INVAL;
+	sysstat_enter(syscallno);
 
 	switch (syscallno) {
 	case SYS_cputs:
@@ -551,7 +762,7 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		ret = sys_ipc_try_send(a1, a2, (void *)a3, a4);
 		break;
 	case SYS_ipc_recv:
-		ret = sys_ipc_recv((void *)a1);
+		ret = sys_ipc_recv((void *)a1, a2);
 		break;
 	case SYS_env_set_trapframe:
 		ret = sys_env_set_trapframe((envid_t)a1, (struct Trapframe *)a2);
@@ -565,6 +776,33 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	case SYS_rx_data:
 		ret = sys_rx_data((void *)a1);
 		break;
+	case SYS_sleep_until:
+		ret = sys_sleep_until(a1);
+		break;
+	case SYS_prof:
+		ret = sys_prof(a1, (struct ProfSample *)a2, a3);
+		break;
+	case SYS_stats:
+		ret = sys_stats(a1, (struct SysStat *)a2, a3);
+		break;
+	case SYS_tx_batch:
+		ret = sys_tx_batch((const struct jif_pkt *)a1, a2);
+		break;
+	case SYS_rx_batch:
+		ret = sys_rx_batch((void *)a1, a2);
+		break;
+	case SYS_tx_wait:
+		ret = sys_tx_wait();
+		break;
+	case SYS_rx_bind:
+		ret = sys_rx_bind(a1);
+		break;
+	case SYS_nic_map:
+		ret = sys_nic_map((void *)a1, a2);
+		break;
+	case SYS_nic_kick:
+		ret = sys_nic_kick(a1, a2);
+		break;
 	default:
 		return -E_INVAL;
 	}
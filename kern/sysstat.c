@@ -0,0 +1,130 @@
+// System call statistics.
+//
+// syscall() calls sysstat_enter(); the matching sysstat_exit() happens
+// in env_run() or sched_halt(), right before the CPU leaves the kernel.
+// Measuring up to there charges a system call that blocks or yields
+// with the kernel time it took to switch away, not with the time it
+// spent waiting.  All of this runs with the big kernel lock held.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/syscall.h>
+#include <inc/x86.h>
+
+#include <kern/sysstat.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+static struct SysStat sysstat_global[NSYSCALLS];
+
+// Per-env statistics, indexed by ENVX.  Each is a page allocated on the
+// environment's first system call.
+static struct SysStat *sysstat_env[NENV];
+
+// The system call each CPU is executing
+static struct {
+	bool sp_active;
+	uint32_t sp_syscallno;
+	uint64_t sp_tsc;		// When it entered the kernel
+	struct SysStat *sp_env;		// Its environment's statistics
+} sysstat_pending[NCPU];
+
+static const struct SysStat sysstat_zero[NSYSCALLS];
+
+void
+sysstat_enter(uint32_t syscallno)
+{
+	struct PageInfo *pp;
+	struct SysStat **es = &sysstat_env[ENVX(curenv->env_id)];
+
+	static_assert(NSYSCALLS * sizeof(struct SysStat) <= PGSIZE);
+	if (!*es && (pp = page_alloc(ALLOC_ZERO))) {
+		pp->pp_ref++;
+		*es = page2kva(pp);
+	}
+	sysstat_pending[cpunum()].sp_active = 1;
+	sysstat_pending[cpunum()].sp_syscallno = syscallno;
+	sysstat_pending[cpunum()].sp_env = *es;
+	sysstat_pending[cpunum()].sp_tsc = read_tsc();
+}
+
+static void
+sysstat_account(struct SysStat *s, uint64_t cycles)
+{
+	int b;
+
+	s->ss_count++;
+	s->ss_cycles += cycles;
+	static_assert(SYSSTAT_NBUCKETS == 32);
+	if (cycles >> 32)
+		b = SYSSTAT_NBUCKETS - 1;
+	else
+		b = cycles ? 31 - __builtin_clz((uint32_t) cycles) : 0;
+	s->ss_hist[b]++;
+}
+
+//
+// Account the system call this CPU is executing, if any.
+// Called when the CPU is about to leave the kernel.
+//
+void
+sysstat_exit(void)
+{
+	uint64_t cycles;
+	int i = cpunum();
+
+	if (!sysstat_pending[i].sp_active)
+		return;
+	cycles = read_tsc() - sysstat_pending[i].sp_tsc;
+	sysstat_account(&sysstat_global[sysstat_pending[i].sp_syscallno],
+			cycles);
+	if (sysstat_pending[i].sp_env)
+		sysstat_account(&sysstat_pending[i].sp_env
+				[sysstat_pending[i].sp_syscallno], cycles);
+	sysstat_pending[i].sp_active = 0;
+}
+
+//
+// Copy the NSYSCALLS statistics of 'envid', or the system-wide ones if
+// envid is SYSSTAT_GLOBAL, into the user buffer 'buf', then clear them
+// if 'reset' is set.
+// Returns NSYSCALLS, -E_BAD_ENV if envid does not exist, or -E_FAULT
+// if 'buf' is bad.
+//
+int
+sysstat_read(envid_t envid, struct SysStat *buf, bool reset)
+{
+	struct SysStat *s;
+	struct Env *e;
+	int r;
+
+	if (envid == SYSSTAT_GLOBAL)
+		s = sysstat_global;
+	else {
+		if ((r = envid2env(envid, &e, 0)) < 0)
+			return r;
+		s = sysstat_env[ENVX(e->env_id)];
+	}
+	if (copy_to_user(buf, s ? s : sysstat_zero,
+			 NSYSCALLS * sizeof(struct SysStat)) < 0)
+		return -E_FAULT;
+	if (s && reset)
+		memset(s, 0, NSYSCALLS * sizeof(struct SysStat));
+	return NSYSCALLS;
+}
+
+void
+sysstat_env_free(struct Env *e)
+{
+	struct SysStat **es = &sysstat_env[ENVX(e->env_id)];
+
+	if (!*es)
+		return;
+	// e may be freed by its own system call
+	if (sysstat_pending[cpunum()].sp_env == *es)
+		sysstat_pending[cpunum()].sp_env = NULL;
+	page_decref(pa2page(PADDR(*es)));
+	*es = NULL;
+}
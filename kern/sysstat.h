@@ -0,0 +1,18 @@
+#ifndef JOS_KERN_SYSSTAT_H
+#define JOS_KERN_SYSSTAT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/sysstat.h>
+
+struct Env;
+
+// Always-on system call counters and latency histograms, kept for the
+// whole system and for each environment.
+void sysstat_enter(uint32_t syscallno);
+void sysstat_exit(void);
+int sysstat_read(envid_t envid, struct SysStat *buf, bool reset);
+void sysstat_env_free(struct Env *e);
+
+#endif /* JOS_KERN_SYSSTAT_H */
@@ -15,12 +15,18 @@ void
 time_tick(void)
 {
 	ticks++;
-	if (ticks * 10 < ticks)
+	if (ticks * TICK_MSEC < ticks)
 		panic("time_tick: time overflowed");
 }
 
 unsigned int
 time_msec(void)
 {
-	return ticks * 10;
+	return ticks * TICK_MSEC;
+}
+
+unsigned int
+time_ticks(void)
+{
+	return ticks;
 }
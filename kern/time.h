@@ -4,8 +4,12 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+// Milliseconds per timer interrupt
+#define TICK_MSEC	10
+
 void time_init(void);
 void time_tick(void);
 unsigned int time_msec(void);
+unsigned int time_ticks(void);
 
 #endif /* JOS_KERN_TIME_H */
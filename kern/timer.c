@@ -0,0 +1,192 @@
+// Hierarchical timer wheel, driven by the LAPIC timer interrupt.
+//
+// Level 0 has one slot per tick for the next TW_SLOTS ticks; every
+// higher level covers TW_SLOTS times the range of the level below it.
+// Whenever a level wraps around, the next slot of the level above is
+// cascaded down.  Adding and removing a timer is O(1), and a pending
+// timer is never looked at before its slot comes up.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/timer.h>
+#include <kern/time.h>
+#include <kern/env.h>
+
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	4
+// Longest delta the wheel can hold; later deadlines are re-queued
+#define TW_MAXDELTA	((1 << (TW_BITS * TW_LEVELS)) - 1)
+
+static struct Timer *wheel[TW_LEVELS][TW_SLOTS];
+static uint32_t wheel_ticks;	// Next tick the wheel has to process
+static int wheel_count;		// Number of pending timers
+
+// Per-env timers for sleeps and timed IPC receives, indexed by ENVX.
+static struct Timer env_timers[NENV];
+
+void
+timer_init(void)
+{
+	wheel_ticks = time_ticks();
+	wheel_count = 0;
+}
+
+static void
+wheel_link(struct Timer **slot, struct Timer *t)
+{
+	t->tm_next = *slot;
+	if (t->tm_next)
+		t->tm_next->tm_pprev = &t->tm_next;
+	t->tm_pprev = slot;
+	*slot = t;
+}
+
+static void
+wheel_unlink(struct Timer *t)
+{
+	*t->tm_pprev = t->tm_next;
+	if (t->tm_next)
+		t->tm_next->tm_pprev = t->tm_pprev;
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+}
+
+// Put 't' in the slot matching its deadline, relative to wheel_ticks.
+static void
+wheel_insert(struct Timer *t)
+{
+	uint32_t expires = t->tm_expires;
+	uint32_t delta = expires - wheel_ticks;
+	int level;
+
+	// Overdue timers fire on the next processed tick.
+	if ((int32_t)delta < 0) {
+		expires = wheel_ticks;
+		delta = 0;
+	} else if (delta > TW_MAXDELTA) {
+		expires = wheel_ticks + TW_MAXDELTA;
+		delta = TW_MAXDELTA;
+	}
+
+	for (level = 0; level < TW_LEVELS - 1; level++)
+		if (delta < (1 << (TW_BITS * (level + 1))))
+			break;
+	wheel_link(&wheel[level][(expires >> (TW_BITS * level)) & TW_MASK], t);
+}
+
+// Move every timer of wheel[level][idx] to the level(s) below.
+static void
+wheel_cascade(int level, int idx)
+{
+	struct Timer *t;
+
+	while ((t = wheel[level][idx]) != NULL) {
+		wheel_unlink(t);
+		wheel_insert(t);
+	}
+}
+
+//
+// Arm 't' to call t->tm_func at tick 'expires'.
+// Re-arming a pending timer moves it to the new deadline.
+//
+void
+timer_add(struct Timer *t, uint32_t expires)
+{
+	assert(t->tm_func);
+	if (t->tm_pprev)
+		timer_del(t);
+	t->tm_expires = expires;
+	wheel_insert(t);
+	wheel_count++;
+}
+
+//
+// Disarm 't'.  Does nothing if it is not pending.
+//
+void
+timer_del(struct Timer *t)
+{
+	if (!t->tm_pprev)
+		return;
+	wheel_unlink(t);
+	wheel_count--;
+}
+
+bool
+timer_pending(void)
+{
+	return wheel_count > 0;
+}
+
+//
+// Fire every timer whose deadline has passed.
+// Called on each timer interrupt, after time_tick().  Since all CPUs
+// tick, this catches up on any ticks processed by another CPU.
+//
+void
+timer_run(void)
+{
+	uint32_t now = time_ticks();
+	struct Timer *t;
+	int level, idx;
+
+	while ((int32_t)(now - wheel_ticks) >= 0) {
+		idx = wheel_ticks & TW_MASK;
+		for (level = 1; idx == 0 && level < TW_LEVELS; level++) {
+			idx = (wheel_ticks >> (TW_BITS * level)) & TW_MASK;
+			wheel_cascade(level, idx);
+		}
+
+		idx = wheel_ticks & TW_MASK;
+		wheel_ticks++;
+		while ((t = wheel[0][idx]) != NULL) {
+			wheel_unlink(t);
+			// Deadlines clamped to TW_MAXDELTA go around again
+			if ((int32_t)(t->tm_expires - wheel_ticks) >= 0) {
+				wheel_insert(t);
+				continue;
+			}
+			wheel_count--;
+			t->tm_func(t);
+		}
+	}
+}
+
+static void
+env_timeout(struct Timer *t)
+{
+	struct Env *e = &envs[t - env_timers];
+
+	if (e->env_status != ENV_NOT_RUNNABLE)
+		return;
+	// A timed-out IPC receive fails, a plain sleep just returns.
+	if (e->env_ipc_recving) {
+		e->env_ipc_recving = 0;
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+	} else
+		e->env_tf.tf_regs.reg_eax = 0;
+	e->env_status = ENV_RUNNABLE;
+}
+
+//
+// Make 'e' runnable again once time_msec() reaches 'msec'.
+// The caller marks 'e' ENV_NOT_RUNNABLE.
+//
+void
+timer_env_sleep(struct Env *e, uint32_t msec)
+{
+	struct Timer *t = &env_timers[ENVX(e->env_id)];
+
+	t->tm_func = env_timeout;
+	timer_add(t, msec / TICK_MSEC + (msec % TICK_MSEC != 0));
+}
+
+void
+timer_env_cancel(struct Env *e)
+{
+	timer_del(&env_timers[ENVX(e->env_id)]);
+}
@@ -0,0 +1,32 @@
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+// A kernel timer.  Timers live on a hierarchical timer wheel and cost
+// nothing until the tick they expire on; tm_func is then called with the
+// big kernel lock held.
+struct Timer {
+	struct Timer *tm_next;		// Next timer in the same wheel slot
+	struct Timer **tm_pprev;	// Link pointing at us; NULL if idle
+	uint32_t tm_expires;		// Absolute deadline, in ticks
+	void (*tm_func)(struct Timer *);
+};
+
+void timer_init(void);
+void timer_add(struct Timer *t, uint32_t expires);
+void timer_del(struct Timer *t);
+void timer_run(void);
+bool timer_pending(void);
+
+// Per-environment timeouts, used by sys_sleep_until() and by timed IPC
+// receives.  'msec' is an absolute time as returned by time_msec().
+void timer_env_sleep(struct Env *e, uint32_t msec);
+void timer_env_cancel(struct Env *e);
+
+#endif /* JOS_KERN_TIMER_H */
@@ -0,0 +1,66 @@
+// Kernel event tracing.
+//
+// Every CPU writes fixed-size records into its own ring, so trace
+// points take no lock and cost an rdtsc and a few stores.  Trace points
+// run with interrupts disabled, which makes each CPU the only writer of
+// its ring.  The rings are mapped read-only into every environment at
+// UTRACE; see inc/trace.h for how readers cope with overwrites.
+
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/trace.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+#define TRACE_ORDER	4		// log2 of the pages in a ring
+
+static struct TraceBuf *trace_bufs[NCPU];
+
+//
+// Allocate and map a ring for every CPU.  Called once mp_init() knows
+// the CPUs, and before any environment exists, so the mappings end up
+// in every page directory.
+//
+void
+trace_init(void)
+{
+	struct PageInfo *pp;
+	int i, j;
+
+	static_assert(sizeof(struct TraceBuf) <= TRACE_BUFSIZE);
+	static_assert(TRACE_BUFSIZE == (PGSIZE << TRACE_ORDER));
+	static_assert(UTRACE + NCPU * TRACE_BUFSIZE <= UENVS + PTSIZE);
+
+	for (i = 0; i < ncpu; i++) {
+		if (!(pp = page_alloc_order(TRACE_ORDER, ALLOC_ZERO)))
+			panic("trace_init: out of memory");
+		for (j = 0; j < (1 << TRACE_ORDER); j++)
+			if (page_insert(kern_pgdir, pp + j,
+					(void *) (UTRACE + i * TRACE_BUFSIZE + j * PGSIZE),
+					PTE_U | PTE_P) < 0)
+				panic("trace_init: out of memory");
+		trace_bufs[i] = page2kva(pp);
+		trace_bufs[i]->tb_cpu = i;
+	}
+}
+
+void
+trace_event(int event, uint32_t arg0, uint32_t arg1)
+{
+	struct TraceBuf *tb = trace_bufs[cpunum()];
+	struct TraceRec *r;
+
+	if (!tb)
+		return;
+	r = &tb->tb_recs[tb->tb_head & (TRACE_NRECS - 1)];
+	r->tr_tsc = read_tsc();
+	r->tr_event = event;
+	r->tr_envid = curenv ? curenv->env_id : 0;
+	r->tr_arg[0] = arg0;
+	r->tr_arg[1] = arg1;
+	// The record must be complete before readers can see it
+	asm volatile("" : : : "memory");
+	tb->tb_head++;
+}
@@ -0,0 +1,24 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trace.h>
+
+// Set KTRACE to 0 to compile every trace point out of the kernel.
+#ifndef KTRACE
+#define KTRACE	1
+#endif
+
+void trace_init(void);
+void trace_event(int event, uint32_t arg0, uint32_t arg1);
+
+#if KTRACE
+#define TRACE(event, arg0, arg1) \
+	trace_event((event), (uint32_t) (arg0), (uint32_t) (arg1))
+#else
+#define TRACE(event, arg0, arg1)	do { } while (0)
+#endif
+
+#endif /* JOS_KERN_TRACE_H */
@@ -14,6 +14,10 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/fpu.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
 #include <kern/e1000.h>
 
 void * memcpy(void *, const void *, size_t);
@@ -33,6 +37,16 @@ struct Pseudodesc idt_pd = {
 	sizeof(idt) - 1, (uint32_t) idt
 };
 
+/* Exception table, built by the linker from the .ex_table sections:
+ * kernel instructions that may fault on user addresses (kern/usercopy.S),
+ * and where page_fault_handler should resume when they do.
+ */
+struct ExTableEntry {
+	uintptr_t insn;
+	uintptr_t fixup;
+};
+extern const struct ExTableEntry __EX_TABLE_BEGIN__[], __EX_TABLE_END__[];
+
 
 static const char *trapname(int trapno)
 {
@@ -103,6 +117,8 @@ trap_init(void)
 	extern void irq_ide(void);
 	extern void irq_error(void);
 
+	extern void ipi_tlbflush(void);
+
 	// LAB 3: Your code here.
 	//SETGATE(gate, istrap, sel, off, dpl);
 	SETGATE(idt[T_DIVIDE], 0, GD_KT, idt_divzero, 0);
@@ -133,6 +149,8 @@ trap_init(void)
 	SETGATE(idt[IRQ_OFFSET + IRQ_IDE], 0, GD_KT, irq_ide, 0);
 	SETGATE(idt[IRQ_OFFSET + IRQ_ERROR], 0, GD_KT, irq_error, 0);
 
+	SETGATE(idt[T_TLBFLUSH], 0, GD_KT, ipi_tlbflush, 0);
+
 	// Per-CPU setup 
 	trap_init_percpu();
 }
@@ -246,6 +264,12 @@ trap_dispatch(struct Trapframe *tf)
 		page_fault_handler(tf);
 	}
 
+	// First FPU/SSE instruction since this environment was run
+	if (tf->tf_trapno == T_DEVICE && (tf->tf_cs & 3) == 3) {
+		fpu_trap(tf);
+		return;
+	}
+
 	if (tf->tf_trapno == T_SYSCALL) {
 		ret = syscall(tf->tf_regs.reg_eax,
 		              tf->tf_regs.reg_edx,
@@ -276,7 +300,9 @@ trap_dispatch(struct Trapframe *tf)
 	// LAB 6: Your code here.
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
 		lapic_eoi();
+		prof_sample(tf);
 		time_tick();
+		timer_run();
 		sched_yield();
 		return;
 	}
@@ -320,10 +346,25 @@ trap(struct Trapframe *tf)
 	if (panicstr)
 		asm volatile("hlt");
 
+	TRACE(TRACE_TRAP, tf->tf_trapno,
+	      tf->tf_trapno == T_SYSCALL ? tf->tf_regs.reg_eax : tf->tf_eip);
+
+	// TLB shootdowns are handled without the big kernel lock, since
+	// the CPU that sent them holds it while it waits for us.
+	if (tf->tf_trapno == T_TLBFLUSH) {
+		tlb_shootdown_ack();
+		env_pop_tf(tf);
+	}
+
 	// Re-acqurie the big kernel lock if we were halted in
-	// sched_yield()
-	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
+	// sched_yield().  As for a trap from user mode, say so first: a
+	// TLB shootdown sent meanwhile cannot reach us while we wait.
+	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED) {
+		thiscpu->cpu_in_kernel = 1;
 		lock_kernel();
+		if (thiscpu->cpu_tlb_stale)
+			load_pgdir(thiscpu->cpu_pgdir);
+	}
 	// Check that interrupts are disabled.  If this assertion
 	// fails, DO NOT be tempted to fix it by inserting a "cli" in
 	// the interrupt path.
@@ -334,9 +375,14 @@ trap(struct Trapframe *tf)
 		// Acquire the big kernel lock before doing any
 		// serious kernel work.
 		// LAB 4: Your code here.
+		thiscpu->cpu_in_kernel = 1;
 		lock_kernel();
 		assert(curenv);
 
+		// Catch up on a TLB shootdown we missed while waiting
+		if (thiscpu->cpu_tlb_stale)
+			load_pgdir(thiscpu->cpu_pgdir);
+
 		// Garbage collect if current enviroment is a zombie
 		if (curenv->env_status == ENV_DYING) {
 			env_free(curenv);
@@ -375,14 +421,22 @@ page_fault_handler(struct Trapframe *tf)
 	uint32_t fault_va, offt = sizeof(struct UTrapframe) + 4;
 	uintptr_t esp_base = (uintptr_t)UXSTACKTOP;
 	struct UTrapframe *user_tf;
+	const struct ExTableEntry *ex;
 
 	// Read processor's CR2 register to find the faulting address
 	fault_va = rcr2();
+	TRACE(TRACE_PGFLT, fault_va, tf->tf_eip);
 
 	// Handle kernel-mode page faults.
 
 	// LAB 3: Your code here.
 	if ((tf->tf_cs & 3) == 0) {
+		// A user copy routine touched a bad user address
+		for (ex = __EX_TABLE_BEGIN__; ex < __EX_TABLE_END__; ex++)
+			if (ex->insn == tf->tf_eip) {
+				tf->tf_eip = ex->fixup;
+				env_pop_tf(tf);
+			}
 		print_trapframe(tf);
 		panic("page_fault_handler: fatal error - page fault in kernel\n");
 	}
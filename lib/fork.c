@@ -7,6 +7,29 @@
 // It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
 #define PTE_COW		0x800
 
+// Where pgfault() builds the copy of a copy-on-write 4MB page: the one
+// PTSIZE-aligned region below UTEXT, empty while the handler runs.
+#define PFTEMP_LARGE	UTEMP
+
+//
+// pgfault() for a write to the copy-on-write 4MB page holding 'addr':
+// the same three system calls, on the whole 4MB page.
+//
+static void
+pgfault_large(void *addr)
+{
+	int r, perm = PTE_P | PTE_U | PTE_W | PTE_PS;
+
+	addr = ROUNDDOWN(addr, PTSIZE);
+	if ((r = sys_page_alloc(0, PFTEMP_LARGE, perm)) < 0)
+		panic("pgfault()'s sys_page_alloc: %e", r);
+	memcpy_nosse(PFTEMP_LARGE, addr, PTSIZE);
+	if ((r = sys_page_map(0, PFTEMP_LARGE, 0, addr, perm)) < 0)
+		panic("pgfault()'s sys_page_map: %e", r);
+	if ((r = sys_page_unmap(0, PFTEMP_LARGE)) < 0)
+		panic("pgfault()'s sys_page_unmap: %e", r);
+}
+
 //
 // Custom page fault handler - if faulting page is copy-on-write,
 // map in our own private writable copy.
@@ -28,6 +51,13 @@ pgfault(struct UTrapframe *utf)
 	//   (see <inc/memlayout.h>).
 
 	// LAB 4: Your code here.
+	// a 4MB page has no PTEs; its PDE carries the bits
+	if (uvpd[PDX(addr)] & PTE_PS) {
+		if (!(err & FEC_WR) || !(uvpd[PDX(addr)] & PTE_COW))
+			panic("faulting access was not write or not to COW\n");
+		pgfault_large(addr);
+		return;
+	}
 	if (!(uvpt[PGNUM(addr)] & PTE_P))
 		panic("PTE not present in uvpt");
 	if (!(err & FEC_WR) || (!(PGOFF(uvpt[PGNUM(addr)]) & (PTE_W |PTE_COW))))
@@ -45,8 +75,8 @@ pgfault(struct UTrapframe *utf)
 	r = sys_page_alloc(0, PFTEMP, perm);
 	if (r < 0)
 		panic("pgfault()'s sys_page_alloc: %e", r);
-	// move old contents to new page
-	memmove(PFTEMP, addr, PGSIZE);
+	// move old contents to new page, leaving the FPU alone
+	memcpy_nosse(PFTEMP, addr, PGSIZE);
 	// map created page at old addr
 	r = sys_page_map(0, PFTEMP, 0, addr, perm);
 	if (r < 0)
@@ -100,6 +130,36 @@ duppage(envid_t envid, unsigned pn)
 	return 0;
 }
 
+//
+// duppage() for the 4MB page at 'addr': PTE_SHARE pages are shared
+// with the child as they are, writable ones become copy-on-write in
+// both envs.
+//
+static int
+duppage_large(envid_t envid, uintptr_t addr)
+{
+	int r;
+	pde_t pde = uvpd[PDX(addr)];
+	int perm = PTE_P | PTE_U | PTE_PS;
+
+	if (pde & PTE_SHARE) {
+		r = sys_page_map(0, (void *)addr, envid, (void *)addr,
+				 (pde & PTE_SYSCALL) | PTE_PS);
+		if (r < 0)
+			panic("duppage_large()'s sys_page_map: %e", r);
+		return 0;
+	}
+	if (pde & PTE_W || pde & PTE_COW)
+		perm |= PTE_COW;
+	r = sys_page_map(0, (void *)addr, envid, (void *)addr, perm);
+	if (r < 0)
+		panic("duppage_large()'s sys_page_map: %e", r);
+	r = sys_page_map(0, (void *)addr, 0, (void *)addr, perm);
+	if (r < 0)
+		panic("duppage_large()'s sys_page_map: %e", r);
+	return 0;
+}
+
 //
 // User-level fork with copy-on-write.
 // Set up our page fault handler appropriately.
@@ -136,6 +196,11 @@ fork(void)
 	for (addr = UTEXT; addr < UTOP; addr += PGSIZE) {
 		if (!(uvpd[PDX(addr)] & PTE_P))
 			continue;
+		if (uvpd[PDX(addr)] & PTE_PS) {
+			duppage_large(e, addr);
+			addr += PTSIZE - PGSIZE;
+			continue;
+		}
 		if (addr == UXSTACKTOP - PGSIZE) {
 			sys_page_alloc(e, (void *)UXSTACKTOP - PGSIZE,
 					PTE_P | PTE_U | PTE_W);
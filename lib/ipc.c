@@ -23,14 +23,26 @@ int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 {
 	// LAB 4: Your code here.
+	return ipc_recv_until(from_env_store, pg, perm_store, 0);
+}
+
+// Like ipc_recv, but give up with -E_TIMEOUT once sys_time_msec()
+// reaches 'deadline'.  A zero 'deadline' waits for good.
+int32_t
+ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+	       unsigned int deadline)
+{
 	int ret;
 	int pg_to_recv = (pg == NULL) ? UTOP : (int)pg;
 
-	ret = sys_ipc_recv((void *)pg_to_recv);
+	ret = sys_ipc_recv_until((void *)pg_to_recv, deadline);
 	if (ret) {
-		cprintf("returned %e\n", ret);
-		*from_env_store = 0;
-		*perm_store = 0;
+		if (ret != -E_TIMEOUT)
+			cprintf("returned %e\n", ret);
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
 		return ret;
 	}
 
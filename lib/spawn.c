@@ -308,6 +308,14 @@ copy_shared_pages(envid_t child)
 	for (addr = UTEXT; addr < UTOP; addr += PGSIZE) {
 		if (!(uvpd[PDX(addr)] & PTE_P))
 			continue;
+		if (uvpd[PDX(addr)] & PTE_PS) {
+			if ((uvpd[PDX(addr)] & PTE_SHARE) &&
+			    (r = sys_page_map(0, (void *)addr, child, (void *)addr,
+					      (uvpd[PDX(addr)] & PTE_SYSCALL) | PTE_PS)) < 0)
+				panic("sys_page_map: %e", r);
+			addr += PTSIZE - PGSIZE;
+			continue;
+		}
 		if (!(uvpt[PGNUM(addr)] & PTE_P) ||
 			!(uvpt[PGNUM(addr)] & PTE_SHARE))
 			continue;
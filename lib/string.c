@@ -1,6 +1,7 @@
 // Basic string routines.  Not hardware optimized, but not shabby.
 
 #include <inc/string.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -8,14 +9,27 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
+// Nonzero if some byte of the 32-bit word 'w' is zero
+#define HASZERO(w)	(((w) - 0x01010101) & ~(w) & 0x80808080)
+
+// The word-at-a-time loops below only read aligned words that hold
+// at least one byte of the string, so they never cross into a page
+// the byte-at-a-time version would not have touched.
+
 int
 strlen(const char *s)
 {
-	int n;
+	const char *p = s;
+	const uint32_t *w;
 
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	for (; (uintptr_t) p % 4; p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const uint32_t *) p; !HASZERO(*w); w++)
+		/* do nothing */;
+	for (p = (const char *) w; *p != '\0'; p++)
+		/* do nothing */;
+	return p - s;
 }
 
 int
@@ -79,6 +93,21 @@ strlcpy(char *dst, const char *src, size_t size)
 int
 strcmp(const char *p, const char *q)
 {
+	const uint32_t *wp, *wq;
+
+	// Compare a word at a time if both strings share an alignment
+	if ((uintptr_t) p % 4 == (uintptr_t) q % 4) {
+		while ((uintptr_t) p % 4 && *p && *p == *q)
+			p++, q++;
+		if ((uintptr_t) p % 4 == 0) {
+			wp = (const uint32_t *) p;
+			wq = (const uint32_t *) q;
+			while (*wp == *wq && !HASZERO(*wp))
+				wp++, wq++;
+			p = (const char *) wp;
+			q = (const char *) wq;
+		}
+	}
 	while (*p && *p == *q)
 		p++, q++;
 	return (int) ((unsigned char) *p - (unsigned char) *q);
@@ -118,13 +147,160 @@ strfind(const char *s, char c)
 }
 
 #if ASM
+#ifndef JOS_KERNEL
+// SSE2 versions of memset/memmove for user environments.  The kernel
+// runs with CR0.TS set and must never touch the FPU, so it keeps the
+// string instructions.  Each routine aligns the destination to 16 bytes
+// with string instructions, moves 64 bytes per iteration through
+// %xmm0-%xmm3, and finishes the tail with string instructions again.
+// Only copies of at least SSE_MIN bytes take this path: below that the
+// setup, and the first-use FPU trap, cost more than they save.
+//
+// User code is compiled without SSE, so the compiler never allocates
+// the xmm registers and the asm statements need not list them as
+// clobbers (it would not accept them anyway).  An env may still keep
+// its own values there (see user/testfpu.c), so each routine puts
+// %xmm0-%xmm3 back the way it found them.
+
+#define SSE_MIN		256
+
+static int has_sse2 = -1;
+
+static int
+use_sse2(size_t n)
+{
+	uint32_t edx;
+
+	if (n < SSE_MIN)
+		return 0;
+	if (has_sse2 < 0) {
+		cpuid(1, NULL, NULL, NULL, &edx);
+		has_sse2 = (edx >> 26) & 1;
+	}
+	return has_sse2;
+}
+
+static void
+sse2_save(char *save)
+{
+	asm volatile("movdqu %%xmm0, (%0)\n"
+		"\tmovdqu %%xmm1, 16(%0)\n"
+		"\tmovdqu %%xmm2, 32(%0)\n"
+		"\tmovdqu %%xmm3, 48(%0)\n"
+		: : "r" (save) : "memory");
+}
+
+static void
+sse2_restore(const char *save)
+{
+	asm volatile("movdqu (%0), %%xmm0\n"
+		"\tmovdqu 16(%0), %%xmm1\n"
+		"\tmovdqu 32(%0), %%xmm2\n"
+		"\tmovdqu 48(%0), %%xmm3\n"
+		: : "r" (save) : "memory");
+}
+
+// Store 64 * nblk bytes of the byte 'c' at the 16-byte aligned 'd'.
+static void
+sse2_set(char *d, int c, size_t nblk)
+{
+	char save[64];
+
+	c &= 0xFF;
+	c = (c<<24)|(c<<16)|(c<<8)|c;
+	sse2_save(save);
+	asm volatile("movd %3, %%xmm0\n"
+		"\tpshufd $0, %%xmm0, %%xmm0\n"
+		"1:\tmovdqa %%xmm0, (%0)\n"
+		"\tmovdqa %%xmm0, 16(%0)\n"
+		"\tmovdqa %%xmm0, 32(%0)\n"
+		"\tmovdqa %%xmm0, 48(%0)\n"
+		"\taddl $64, %0\n"
+		"\tdecl %1\n"
+		"\tjnz 1b\n"
+		: "=r" (d), "=r" (nblk)
+		: "0" (d), "r" (c), "1" (nblk)
+		: "cc", "memory");
+	sse2_restore(save);
+}
+
+// Copy 64 * nblk bytes from 's' up to the 16-byte aligned 'd'.  Each
+// block is loaded completely before it is stored, so this is safe for
+// overlapping buffers with d < s.
+static void
+sse2_copy_fwd(char *d, const char *s, size_t nblk)
+{
+	char save[64];
+
+	sse2_save(save);
+	asm volatile("1:\tmovdqu (%1), %%xmm0\n"
+		"\tmovdqu 16(%1), %%xmm1\n"
+		"\tmovdqu 32(%1), %%xmm2\n"
+		"\tmovdqu 48(%1), %%xmm3\n"
+		"\tmovdqa %%xmm0, (%0)\n"
+		"\tmovdqa %%xmm1, 16(%0)\n"
+		"\tmovdqa %%xmm2, 32(%0)\n"
+		"\tmovdqa %%xmm3, 48(%0)\n"
+		"\taddl $64, %1\n"
+		"\taddl $64, %0\n"
+		"\tdecl %2\n"
+		"\tjnz 1b\n"
+		: "+r" (d), "+r" (s), "+r" (nblk)
+		: : "cc", "memory");
+	sse2_restore(save);
+}
+
+// Copy 64 * nblk bytes ending just below 's' down to the ones ending just
+// below the 16-byte aligned 'd', highest block first, for d > s.
+static void
+sse2_copy_bwd(char *d, const char *s, size_t nblk)
+{
+	char save[64];
+
+	sse2_save(save);
+	asm volatile("1:\tsubl $64, %1\n"
+		"\tsubl $64, %0\n"
+		"\tmovdqu 48(%1), %%xmm3\n"
+		"\tmovdqu 32(%1), %%xmm2\n"
+		"\tmovdqu 16(%1), %%xmm1\n"
+		"\tmovdqu (%1), %%xmm0\n"
+		"\tmovdqa %%xmm3, 48(%0)\n"
+		"\tmovdqa %%xmm2, 32(%0)\n"
+		"\tmovdqa %%xmm1, 16(%0)\n"
+		"\tmovdqa %%xmm0, (%0)\n"
+		"\tdecl %2\n"
+		"\tjnz 1b\n"
+		: "+r" (d), "+r" (s), "+r" (nblk)
+		: : "cc", "memory");
+	sse2_restore(save);
+}
+#endif
+
 void *
 memset(void *v, int c, size_t n)
 {
 	char *p;
+#ifndef JOS_KERNEL
+	size_t m;
+#endif
 
 	if (n == 0)
 		return v;
+#ifndef JOS_KERNEL
+	if (use_sse2(n)) {
+		p = v;
+		m = -(uintptr_t) p & 15;
+		asm volatile("cld; rep stosb\n"
+			: "+D" (p), "+c" (m) : "a" (c) : "cc", "memory");
+		n -= -(uintptr_t) v & 15;
+		sse2_set(p, c, n / 64);
+		p += n & ~63;
+		m = n & 63;
+		asm volatile("cld; rep stosb\n"
+			: "+D" (p), "+c" (m) : "a" (c) : "cc", "memory");
+		return v;
+	}
+#endif
 	if ((int)v%4 == 0 && n%4 == 0) {
 		c &= 0xFF;
 		c = (c<<24)|(c<<16)|(c<<8)|c;
@@ -143,9 +319,46 @@ memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
+#ifndef JOS_KERNEL
+	const char *se;
+	char *de;
+	size_t m;
+#endif
 
 	s = src;
 	d = dst;
+#ifndef JOS_KERNEL
+	if (use_sse2(n)) {
+		if (s < d && s + n > d) {
+			// Backwards: the bytes above the last aligned block of
+			// 'd', then the blocks, then the head.
+			de = d + n - 1;
+			se = s + n - 1;
+			m = (uintptr_t) (d + n) & 15;
+			n -= m;
+			asm volatile("std; rep movsb; cld\n"
+				: "+D" (de), "+S" (se), "+c" (m) : : "cc", "memory");
+			sse2_copy_bwd(d + n, s + n, n / 64);
+			m = n & 63;
+			de = d + m - 1;
+			se = s + m - 1;
+			asm volatile("std; rep movsb; cld\n"
+				: "+D" (de), "+S" (se), "+c" (m) : : "cc", "memory");
+		} else {
+			m = -(uintptr_t) d & 15;
+			n -= m;
+			asm volatile("cld; rep movsb\n"
+				: "+D" (d), "+S" (s), "+c" (m) : : "cc", "memory");
+			sse2_copy_fwd(d, s, n / 64);
+			d += n & ~63;
+			s += n & ~63;
+			m = n & 63;
+			asm volatile("cld; rep movsb\n"
+				: "+D" (d), "+S" (s), "+c" (m) : : "cc", "memory");
+		}
+		return dst;
+	}
+#endif
 	if (s < d && s + n > d) {
 		s += n;
 		d += n;
@@ -211,12 +424,34 @@ memcpy(void *dst, const void *src, size_t n)
 	return memmove(dst, src, n);
 }
 
+// memcpy() that never uses the FPU, for code that runs in whatever env
+// it finds itself in, like the copy-on-write fault handler: an env that
+// does not otherwise use the FPU then need not get FPU state for it.
+void *
+memcpy_nosse(void *dst, const void *src, size_t n)
+{
+#if ASM
+	if ((int)src%4 == 0 && (int)dst%4 == 0 && n%4 == 0)
+		asm volatile("cld; rep movsl\n"
+			:: "D" (dst), "S" (src), "c" (n/4) : "cc", "memory");
+	else
+		asm volatile("cld; rep movsb\n"
+			:: "D" (dst), "S" (src), "c" (n) : "cc", "memory");
+	return dst;
+#else
+	return memmove(dst, src, n);
+#endif
+}
+
 int
 memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
 
+	// Skip equal words, then find the differing byte
+	while (n >= 4 && *(const uint32_t *) s1 == *(const uint32_t *) s2)
+		s1 += 4, s2 += 4, n -= 4;
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
@@ -118,6 +118,12 @@ sys_ipc_recv(void *dstva)
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_recv_until(void *dstva, unsigned int msec)
+{
+	return syscall(SYS_ipc_recv, 0, (uint32_t)dstva, msec, 0, 0, 0);
+}
+
 unsigned int
 sys_time_msec(void)
 {
@@ -125,7 +131,7 @@ sys_time_msec(void)
 }
 
 int
-sys_tx_data(const char* data, uint8_t nbytes)
+sys_tx_data(const char *data, size_t nbytes)
 {
 	return (int) syscall(SYS_tx_data, 0, (uint32_t)data, nbytes, 0, 0, 0);
 }
@@ -135,3 +141,57 @@ sys_rx_data(void *data)
 {
 	return (int) syscall(SYS_rx_data, 0, (uint32_t)data, 0, 0, 0, 0);
 }
+
+int
+sys_sleep_until(unsigned int msec)
+{
+	return syscall(SYS_sleep_until, 0, msec, 0, 0, 0, 0);
+}
+
+int
+sys_prof(int cmd, struct ProfSample *buf, size_t n)
+{
+	return syscall(SYS_prof, 0, cmd, (uint32_t)buf, n, 0, 0);
+}
+
+int
+sys_stats(envid_t envid, struct SysStat *buf, bool reset)
+{
+	return syscall(SYS_stats, 0, envid, (uint32_t)buf, reset, 0, 0);
+}
+
+int
+sys_tx_batch(const struct jif_pkt *pkts, int n)
+{
+	return syscall(SYS_tx_batch, 0, (uint32_t)pkts, n, 0, 0, 0);
+}
+
+int
+sys_rx_batch(void *va, int n)
+{
+	return syscall(SYS_rx_batch, 0, (uint32_t)va, n, 0, 0, 0);
+}
+
+int
+sys_tx_wait(void)
+{
+	return syscall(SYS_tx_wait, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_rx_bind(int q)
+{
+	return syscall(SYS_rx_bind, 0, q, 0, 0, 0, 0);
+}
+
+int
+sys_nic_map(void *va, uint32_t value)
+{
+	return syscall(SYS_nic_map, 0, (uint32_t)va, value, 0, 0, 0);
+}
+
+int
+sys_nic_kick(int rdt, int tdt)
+{
+	return syscall(SYS_nic_kick, 0, rdt, tdt, 0, 0, 0);
+}
@@ -2,29 +2,109 @@
 
 extern union Nsipc nsipcbuf;
 
+// Most packets sys_rx_batch hands over at once
+#define INPUT_BATCH	16
+
+// Pages the kernel maps received packets into; a jumbo frame takes
+// several in a row
+static union Nsipc rxpages[INPUT_BATCH] __attribute__((aligned(PGSIZE)));
+
+// Packets in the batch being built in nsipcbuf, and where the next
+// one goes
+static int npkts;
+static struct jif_pkt *next;
+
+// Send the batch being built in nsipcbuf, if it holds anything.
+static void
+flush_batch(envid_t ns_envid)
+{
+	if (npkts == 0)
+		return;
+	nsipcbuf.batch.jb_npkts = npkts;
+	ipc_send(ns_envid, NSREQ_INPUT_BATCH, &nsipcbuf, PTE_P|PTE_U|PTE_W);
+	// start the next batch on a fresh page; the network server is
+	// still reading this one
+	sys_page_unmap(0, &nsipcbuf);
+	npkts = 0;
+}
+
+// Append 'pkt' to the batch in nsipcbuf, sending the batch first if
+// 'pkt' does not fit.
+static void
+add_to_batch(envid_t ns_envid, struct jif_pkt *pkt)
+{
+	int r, size = sizeof(*pkt) + pkt->jp_len;
+
+	if (npkts && (char *) next + size > (char *) &nsipcbuf + PGSIZE)
+		flush_batch(ns_envid);
+	if (npkts == 0) {
+		if ((r = sys_page_alloc(0, &nsipcbuf, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		next = (struct jif_pkt *) nsipcbuf.batch.jb_data;
+	}
+	memmove(next, pkt, size);
+	next = JIF_PKT_NEXT(next);
+	npkts++;
+}
+
+// Send the packet that starts at rxpages[p] and runs on into the pages
+// after it on its own, and wait until the network server has taken it
+// in, since it reads those pages straight from ours.
+static void
+send_long(envid_t ns_envid, int p)
+{
+	char *win = (char *) NSINPUT_VA;
+	int i, r, n = JIF_PKT_PAGES(&rxpages[p].pkt);
+
+	// keep the packets in order
+	flush_batch(ns_envid);
+	for (i = 1; i < n; i++)
+		if ((r = sys_page_map(0, &rxpages[p + i], 0, win + i * PGSIZE,
+				      PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_map: %e", r);
+	ipc_send(ns_envid, NSREQ_INPUT, &rxpages[p], PTE_P|PTE_U|PTE_W);
+	ipc_recv(0, 0, 0);
+}
+
 void
-input(envid_t ns_envid)
+input(envid_t ns_envid, int rxq)
 {
 	binaryname = "ns_input";
-	int r;
+	int i, n, p;
 	int perm = PTE_P|PTE_U|PTE_W;
 
+	// take the packets of receive queue 'rxq', on its CPU
+	if ((n = sys_rx_bind(rxq)) < 0)
+		panic("sys_rx_bind: %e", n);
+
 	// LAB 6: Your code here:
 	// 	- read a packet from the device driver
 	//	- send it to the network server
 	// Hint: When you IPC a page to the network server, it will be
 	// reading from it for a while, so don't immediately receive
 	// another packet in to the same physical page.
+	//
+	// The kernel maps each packet at rxpages[i] in a page of its own,
+	// already laid out as a struct jif_pkt.  A lone packet goes to the
+	// network server in that page, with no copy.  When the card had
+	// several ready, they are packed into NSREQ_INPUT_BATCH pages
+	// instead: copying a packet is cheaper than an IPC round trip
+	// through the scheduler for each one.  A jumbo frame fills pages
+	// of its own and always goes alone.
 	while (1) {
-		if ((r = sys_page_alloc(sys_getenvid(), &nsipcbuf, perm)) < 0)
-			panic("sys_page_alloc: %e", r);
-		r = 0;
-		while ((r = sys_rx_data(&nsipcbuf)) == -E_E1000_NOT_RX)
+		while ((n = sys_rx_batch(rxpages, INPUT_BATCH)) == -E_E1000_NOT_RX)
 			;
-		if (!r)
+		if (n <= 0)
+			continue;
+		if (n == 1 && JIF_PKT_PAGES(&rxpages[0].pkt) == 1) {
+			ipc_send(ns_envid, NSREQ_INPUT, &rxpages[0], perm);
 			continue;
-		memcpy(nsipcbuf.pkt.jp_data, &nsipcbuf, r);
-		nsipcbuf.pkt.jp_len = r;
-		ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf.pkt, perm);
+		}
+		for (i = p = 0; i < n; p += JIF_PKT_PAGES(&rxpages[p].pkt), i++)
+			if (JIF_PKT_PAGES(&rxpages[p].pkt) > 1)
+				send_long(ns_envid, p);
+			else
+				add_to_batch(ns_envid, &rxpages[p].pkt);
+		flush_batch(ns_envid);
 	}
 }
@@ -40,6 +40,8 @@
 
 #include "lwip/inet_chksum.h"
 #include "lwip/inet.h"
+#include "lwip/ip.h"
+#include "lwip/netif.h"
 
 /* These are some reference implementations of the checksum algorithm, with the
  * aim of being simple, correct and fully portable. Checksumming is the
@@ -378,6 +380,43 @@ inet_chksum_pseudo_partial(struct pbuf *p,
   return (u16_t)~(acc & 0xffffUL);
 }
 
+/* inet_chksum_pseudo_tx:
+ *
+ * Like inet_chksum_pseudo, for an outgoing TCP or UDP packet.  If the netif
+ * it is routed to computes checksums (NETIF_OFFLOAD_CSUM) and it will not be
+ * fragmented, only the pseudo header is summed, and not complemented: the
+ * hardware adds in the rest of the packet.  p is then marked
+ * PBUF_FLAG_CSUM_L4.
+ *
+ * @return checksum (as u16_t) to be saved directly in the protocol header
+ */
+u16_t
+inet_chksum_pseudo_tx(struct pbuf *p,
+       struct ip_addr *src, struct ip_addr *dest,
+       u8_t proto, u16_t proto_len)
+{
+  struct netif *netif;
+  u32_t acc;
+
+  netif = ip_route(dest);
+  if (netif == NULL || !(netif->offload & NETIF_OFFLOAD_CSUM) ||
+      proto_len + IP_HLEN > netif->mtu) {
+    p->flags &= ~PBUF_FLAG_CSUM_L4;
+    return inet_chksum_pseudo(p, src, dest, proto, proto_len);
+  }
+
+  acc = (src->addr & 0xffffUL);
+  acc += ((src->addr >> 16) & 0xffffUL);
+  acc += (dest->addr & 0xffffUL);
+  acc += ((dest->addr >> 16) & 0xffffUL);
+  acc += (u32_t)htons((u16_t)proto);
+  acc += (u32_t)htons(proto_len);
+  acc = FOLD_U32T(acc);
+  acc = FOLD_U32T(acc);
+  p->flags |= PBUF_FLAG_CSUM_L4;
+  return (u16_t)acc;
+}
+
 /* inet_chksum:
  *
  * Calculates the Internet checksum over a portion of memory. Used primarily for IP
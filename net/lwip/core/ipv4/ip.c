@@ -224,7 +224,7 @@ ip_input(struct pbuf *p, struct netif *inp)
 
   /* verify checksum */
 #if CHECKSUM_CHECK_IP
-  if (inet_chksum(iphdr, iphdr_hlen) != 0) {
+  if (!(p->flags & PBUF_FLAG_CSUM_IP) && inet_chksum(iphdr, iphdr_hlen) != 0) {
 
     LWIP_DEBUGF(IP_DEBUG | 2, ("Checksum (0x%"X16_F") failed, IP packet dropped.\n", inet_chksum(iphdr, iphdr_hlen)));
     ip_debug_print(p);
@@ -512,17 +512,30 @@ ip_output_if(struct pbuf *p, struct ip_addr *src, struct ip_addr *dest,
 
     IPH_CHKSUM_SET(iphdr, 0);
 #if CHECKSUM_GEN_IP
-    IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, IP_HLEN));
+    if (netif->offload & NETIF_OFFLOAD_CSUM) {
+      /* the netif fills it in */
+      p->flags |= PBUF_FLAG_CSUM_IP;
+    } else {
+      p->flags &= ~PBUF_FLAG_CSUM_IP;
+      IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, IP_HLEN));
+    }
 #endif
+    /* only TCP and UDP leave their checksum to the netif */
+    if (proto != IP_PROTO_TCP && proto != IP_PROTO_UDP) {
+      p->flags &= ~PBUF_FLAG_CSUM_L4;
+    }
   } else {
-    /* IP header already included in p */
+    /* IP header already included in p, checksums and all; p may be a
+       received packet sent back, so drop the input flags */
+    p->flags &= ~(PBUF_FLAG_CSUM_IP | PBUF_FLAG_CSUM_L4 | PBUF_FLAG_TSO);
     iphdr = p->payload;
     dest = &(iphdr->dest);
   }
 
 #if IP_FRAG
-  /* don't fragment if interface has mtu set to 0 [loopif] */
-  if (netif->mtu && (p->tot_len > netif->mtu))
+  /* don't fragment if interface has mtu set to 0 [loopif], nor a
+     segment the interface cuts up itself */
+  if (netif->mtu && (p->tot_len > netif->mtu) && !(p->flags & PBUF_FLAG_TSO))
     return ip_frag(p,netif,dest);
 #endif
 
@@ -566,6 +566,8 @@ ip_reass(struct pbuf *p)
     IPH_CHKSUM_SET(fraghdr, inet_chksum(fraghdr, IP_HLEN));
 
     p = ipr->p;
+    /* the netif only checked the first fragment */
+    p->flags &= ~(PBUF_FLAG_CSUM_IP | PBUF_FLAG_CSUM_L4);
 
     /* chain together the pbufs contained within the reass_data list. */
     while(r != NULL) {
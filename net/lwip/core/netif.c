@@ -95,6 +95,8 @@ netif_add(struct netif *netif, struct ip_addr *ipaddr, struct ip_addr *netmask,
   netif->netmask.addr = 0;
   netif->gw.addr = 0;
   netif->flags = 0;
+  netif->offload = 0;
+  netif->tso_max = 0;
 #if LWIP_DHCP
   /* netif not under DHCP control by default */
   netif->dhcp = NULL;
@@ -58,6 +58,7 @@
 
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
+static void tcp_output_tso(struct tcp_seg **segs, int n, struct tcp_pcb *pcb);
 
 /**
  * Called by tcp_close() to send a segment including flags but not data.
@@ -400,6 +401,40 @@ memerr:
   return ERR_MEM;
 }
 
+/**
+ * Largest packet the netif pcb sends through takes for TCP segmentation
+ * offload, or 0 if it does not do TSO.  The netif has to compute the
+ * checksums as well.
+ *
+ * @param pcb the tcp_pcb about to send
+ * @return the netif's tso_max, or 0
+ */
+static u16_t
+tcp_tso_max(struct tcp_pcb *pcb)
+{
+  struct netif *netif;
+
+  netif = ip_route(&(pcb->remote_ip));
+  if (netif == NULL ||
+      (netif->offload & (NETIF_OFFLOAD_CSUM | NETIF_OFFLOAD_TSO)) !=
+      (NETIF_OFFLOAD_CSUM | NETIF_OFFLOAD_TSO)) {
+    return 0;
+  }
+  return netif->tso_max;
+}
+
+/**
+ * Whether seg may be sent together with others by tcp_output_tso(): it
+ * has to carry data and nothing the segments the netif cuts out of a run
+ * could not all repeat, i.e. options, SYN, FIN or URG.
+ */
+static int
+tcp_tso_ok(struct tcp_seg *seg)
+{
+  return seg->len > 0 && TCPH_HDRLEN(seg->tcphdr) == 5 &&
+    (TCPH_FLAGS(seg->tcphdr) & (TCP_SYN | TCP_FIN | TCP_RST | TCP_URG)) == 0;
+}
+
 /**
  * Find out what we can send and send it
  *
@@ -414,6 +449,10 @@ tcp_output(struct tcp_pcb *pcb)
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg, *useg;
   u32_t wnd;
+  /* segments to go to the netif as one, see tcp_output_tso() */
+  struct tcp_seg *tso_segs[TCP_TSO_SEGS];
+  int tso_n = 0;
+  u16_t tso_len = 0, tso_max;
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
@@ -466,7 +505,7 @@ tcp_output(struct tcp_pcb *pcb)
 
     tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-    tcphdr->chksum = inet_chksum_pseudo(p, &(pcb->local_ip), &(pcb->remote_ip),
+    tcphdr->chksum = inet_chksum_pseudo_tx(p, &(pcb->local_ip), &(pcb->remote_ip),
           IP_PROTO_TCP, p->tot_len);
 #endif
 #if LWIP_NETIF_HWADDRHINT
@@ -510,6 +549,8 @@ tcp_output(struct tcp_pcb *pcb)
                  ntohl(seg->tcphdr->seqno), pcb->lastack));
   }
 #endif /* TCP_CWND_DEBUG */
+  tso_max = tcp_tso_max(pcb);
+
   /* data available and window allows it to be sent? */
   while (seg != NULL &&
          ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
@@ -542,7 +583,26 @@ tcp_output(struct tcp_pcb *pcb)
       pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
     }
 
-    tcp_output_segment(seg, pcb);
+    if (tso_max != 0 && tcp_tso_ok(seg)) {
+      /* put data segments off, to go to the netif together with the
+         ones that follow them in sequence */
+      if (tso_n > 0 &&
+          (tso_n == TCP_TSO_SEGS ||
+           ntohl(seg->tcphdr->seqno) !=
+           ntohl(tso_segs[0]->tcphdr->seqno) + tso_len ||
+           IP_HLEN + TCP_HLEN + tso_len + seg->len > tso_max)) {
+        tcp_output_tso(tso_segs, tso_n, pcb);
+        tso_n = 0;
+        tso_len = 0;
+      }
+      tso_segs[tso_n++] = seg;
+      tso_len += seg->len;
+    } else {
+      tcp_output_tso(tso_segs, tso_n, pcb);
+      tso_n = 0;
+      tso_len = 0;
+      tcp_output_segment(seg, pcb);
+    }
     pcb->snd_nxt = ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
     if (TCP_SEQ_LT(pcb->snd_max, pcb->snd_nxt)) {
       pcb->snd_max = pcb->snd_nxt;
@@ -575,6 +635,7 @@ tcp_output(struct tcp_pcb *pcb)
     }
     seg = pcb->unsent;
   }
+  tcp_output_tso(tso_segs, tso_n, pcb);
 
   if (seg != NULL && pcb->persist_backoff == 0 && 
       ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > pcb->snd_wnd) {
@@ -588,13 +649,16 @@ tcp_output(struct tcp_pcb *pcb)
 }
 
 /**
- * Called by tcp_output() to actually send a TCP segment over IP.
+ * Called by tcp_output_segment() and tcp_output_tso() to fill in the
+ * parts of a segment's header that change from one transmission to the
+ * next, and to start the timers.
  *
- * @param seg the tcp_seg to send
+ * @param seg the tcp_seg about to be sent
  * @param pcb the tcp_pcb for the TCP connection used to send the segment
+ * @return 0 if there is no route to send it by
  */
-static void
-tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
+static int
+tcp_output_segment_prepare(struct tcp_seg *seg, struct tcp_pcb *pcb)
 {
   u16_t len;
   struct netif *netif;
@@ -614,7 +678,7 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   if (ip_addr_isany(&(pcb->local_ip))) {
     netif = ip_route(&(pcb->remote_ip));
     if (netif == NULL) {
-      return;
+      return 0;
     }
     ip_addr_set(&(pcb->local_ip), &(netif->ip_addr));
   }
@@ -639,10 +703,25 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   seg->p->tot_len -= len;
 
   seg->p->payload = seg->tcphdr;
+  return 1;
+}
+
+/**
+ * Called by tcp_output() to actually send a TCP segment over IP.
+ *
+ * @param seg the tcp_seg to send
+ * @param pcb the tcp_pcb for the TCP connection used to send the segment
+ */
+static void
+tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
+{
+  if (!tcp_output_segment_prepare(seg, pcb)) {
+    return;
+  }
 
   seg->tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
+  seg->tcphdr->chksum = inet_chksum_pseudo_tx(seg->p,
              &(pcb->local_ip),
              &(pcb->remote_ip),
              IP_PROTO_TCP, seg->p->tot_len);
@@ -666,6 +745,109 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 #endif /* LWIP_NETIF_HWADDRHINT*/
 }
 
+/**
+ * Called by tcp_output() to send a run of data segments, consecutive in
+ * sequence, over IP as one packet for a netif with NETIF_OFFLOAD_TSO to
+ * cut up again (see tcp_tso_ok()).  The packet is the first segment's
+ * header, with PSH if any of them has it, followed by the data of all of
+ * them, by reference: the netif copies it before ip_output() returns.
+ * The segments themselves stay as they are, to be acknowledged and
+ * retransmitted one by one.
+ *
+ * @param segs the segments to send, in sequence
+ * @param n how many; nothing happens for 0
+ * @param pcb the tcp_pcb for the TCP connection used to send the segments
+ */
+static void
+tcp_output_tso(struct tcp_seg **segs, int n, struct tcp_pcb *pcb)
+{
+  struct pbuf *p, *q, *r;
+  struct tcp_hdr *tcphdr;
+  u8_t *data;
+  u16_t len;
+  int i;
+
+  if (n <= 1) {
+    if (n == 1) {
+      tcp_output_segment(segs[0], pcb);
+    }
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!tcp_output_segment_prepare(segs[i], pcb)) {
+      return;
+    }
+  }
+
+  p = pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM);
+  for (i = 0; p != NULL && i < n; i++) {
+    for (q = segs[i]->p; q != NULL; q = q->next) {
+      data = q->payload;
+      len = q->len;
+      if (q == segs[i]->p) {
+        /* the segment's own header comes first */
+        data += TCP_HLEN;
+        len -= TCP_HLEN;
+      }
+      if (len == 0) {
+        continue;
+      }
+      r = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+      if (r == NULL) {
+        pbuf_free(p);
+        p = NULL;
+        break;
+      }
+      r->payload = data;
+      pbuf_cat(p, r);
+    }
+  }
+  if (p == NULL) {
+    /* out of pbufs: send them the usual way */
+    LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output_tso: could not allocate pbufs\n"));
+    for (i = 0; i < n; i++) {
+      tcp_output_segment(segs[i], pcb);
+    }
+    return;
+  }
+
+  tcphdr = p->payload;
+  SMEMCPY(tcphdr, segs[0]->tcphdr, TCP_HLEN);
+  for (i = 1; i < n; i++) {
+    if (TCPH_FLAGS(segs[i]->tcphdr) & TCP_PSH) {
+      TCPH_SET_FLAG(tcphdr, TCP_PSH);
+    }
+  }
+  p->flags |= PBUF_FLAG_TSO;
+  p->tso_mss = pcb->mss;
+
+  tcphdr->chksum = 0;
+#if CHECKSUM_GEN_TCP
+  /* the netif adds in each segment's own length */
+  tcphdr->chksum = inet_chksum_pseudo_tx(p, &(pcb->local_ip),
+             &(pcb->remote_ip), IP_PROTO_TCP, 0);
+#endif
+  TCP_STATS_INC(tcp.xmit);
+
+#if LWIP_NETIF_HWADDRHINT
+  {
+    struct netif *netif;
+    netif = ip_route(&pcb->remote_ip);
+    if(netif != NULL){
+      netif->addr_hint = &(pcb->addr_hint);
+      ip_output_if(p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl,
+                   pcb->tos, IP_PROTO_TCP, netif);
+      netif->addr_hint = NULL;
+    }
+  }
+#else /* LWIP_NETIF_HWADDRHINT*/
+  ip_output(p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
+      IP_PROTO_TCP);
+#endif /* LWIP_NETIF_HWADDRHINT*/
+  pbuf_free(p);
+}
+
 /**
  * Send a TCP RESET packet (empty segment with RST flag set) either to
  * abort a connection or to show that there is no matching local connection
@@ -713,7 +895,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  tcphdr->chksum = inet_chksum_pseudo(p, local_ip, remote_ip,
+  tcphdr->chksum = inet_chksum_pseudo_tx(p, local_ip, remote_ip,
               IP_PROTO_TCP, p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
@@ -837,7 +1019,7 @@ tcp_keepalive(struct tcp_pcb *pcb)
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  tcphdr->chksum = inet_chksum_pseudo(p, &pcb->local_ip, &pcb->remote_ip,
+  tcphdr->chksum = inet_chksum_pseudo_tx(p, &pcb->local_ip, &pcb->remote_ip,
                                       IP_PROTO_TCP, p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
@@ -923,7 +1105,7 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
 
   tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
-  tcphdr->chksum = inet_chksum_pseudo(p, &pcb->local_ip, &pcb->remote_ip,
+  tcphdr->chksum = inet_chksum_pseudo_tx(p, &pcb->local_ip, &pcb->remote_ip,
                                       IP_PROTO_TCP, p->tot_len);
 #endif
   TCP_STATS_INC(tcp.xmit);
@@ -81,6 +81,13 @@ extern "C" {
 /** if set, the netif has IGMP capability */
 #define NETIF_FLAG_IGMP         0x40U
 
+/** netif->offload: the netif computes IPv4, TCP and UDP checksums on
+ *  output and checks them on input (see PBUF_FLAG_CSUM_IP/_L4) */
+#define NETIF_OFFLOAD_CSUM      0x01U
+/** netif->offload: the netif takes TCP segments of up to tso_max bytes,
+ *  IP header included, and cuts them up itself (see PBUF_FLAG_TSO) */
+#define NETIF_OFFLOAD_TSO       0x02U
+
 /** Generic data structure used for all lwIP network interfaces.
  *  The following fields should be filled in by the initialization
  *  function for the device driver: hwaddr_len, hwaddr[], mtu, flags */
@@ -139,6 +146,10 @@ struct netif {
   u16_t mtu;
   /** flags (see NETIF_FLAG_ above) */
   u8_t flags;
+  /** hardware offloads (see NETIF_OFFLOAD_ above), set by the driver */
+  u8_t offload;
+  /** largest packet for NETIF_OFFLOAD_TSO, like mtu (in bytes) */
+  u16_t tso_max;
   /** descriptive abbreviation */
   char name[2];
   /** number of this interface */
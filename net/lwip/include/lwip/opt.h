@@ -725,6 +725,15 @@
 #define TCP_SND_QUEUELEN                (4 * (TCP_SND_BUF/TCP_MSS))
 #endif
 
+/**
+ * TCP_TSO_SEGS: the most queued segments tcp_output() sends as one to a
+ * netif with NETIF_OFFLOAD_TSO. Each takes a PBUF_REF pbuf or more while
+ * it is sent.
+ */
+#ifndef TCP_TSO_SEGS
+#define TCP_TSO_SEGS                    32
+#endif
+
 /**
  * TCP_SNDLOWAT: TCP writable space (bytes). This must be less than or equal
  * to TCP_SND_BUF. It is the amount of space which must be available in the
@@ -60,6 +60,16 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** outgoing: the netif fills in the IPv4 header checksum;
+ *  incoming: the netif found the IPv4 header checksum good */
+#define PBUF_FLAG_CSUM_IP 0x02U
+/** outgoing: the TCP/UDP checksum field holds only the pseudo header
+ *  sum, and the netif adds the rest (see inet_chksum_pseudo_tx);
+ *  incoming: the netif found the TCP/UDP checksum good */
+#define PBUF_FLAG_CSUM_L4 0x04U
+/** outgoing: a TCP segment the netif cuts into segments of tso_mss
+ *  bytes of payload (see NETIF_OFFLOAD_TSO) */
+#define PBUF_FLAG_TSO 0x08U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -92,7 +102,9 @@ struct pbuf {
    * the stack itself, or pbuf->next pointers from a chain.
    */
   u16_t ref;
-  
+
+  /** payload bytes per segment, for PBUF_FLAG_TSO */
+  u16_t tso_mss;
 };
 
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
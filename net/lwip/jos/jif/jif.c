@@ -32,6 +32,7 @@
 
 #include <inc/lib.h>
 #include <inc/ns.h>
+#include <inc/nicring.h>
 
 #include <jif/jif.h>
 
@@ -45,10 +46,27 @@
 #include <netif/etharp.h>
 
 #define PKTMAP		0x10000000
+#define NICMAP		0x22000000	/* the card's rings, with NS_NICMAP */
+
+#if defined(NS_NICMAP) && JIF_MTU > 1500
+#error "the network server's own rings take frames of up to 1514 bytes"
+#endif
 
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
+    int npkts;			/* packets waiting at PKTMAP */
+    struct jif_pkt *next;	/* where the next one goes */
+    char *end;			/* end of the pages allocated for them */
+    int window;			/* where the output env takes them, 0 or 1 */
+
+    /* when we drive the card's rings at NICMAP ourselves */
+    char *nic;
+    int rx_next;		/* next rx slot the card may have filled */
+    int rdt;			/* rx tail the card was last given */
+    int tx_next;		/* next tx slot to fill */
+    int tx_clean;		/* oldest tx slot the card may still hold */
+    int tdt;			/* tx tail the card was last given */
 };
 
 static void
@@ -57,8 +75,16 @@ low_level_init(struct netif *netif)
     int r;
 
     netif->hwaddr_len = 6;
-    netif->mtu = 1500;
+    netif->mtu = JIF_MTU;
     netif->flags = NETIF_FLAG_BROADCAST;
+    // the e1000 computes and checks IPv4, TCP and UDP checksums, and
+    // cuts up TCP segments of up to a batch's worth of pages
+    netif->offload = NETIF_OFFLOAD_CSUM | NETIF_OFFLOAD_TSO;
+    netif->tso_max = JIF_TSO_MAX - sizeof(struct eth_hdr);
+    // on our own rings the card still checks checksums, but sends
+    // frames as they are
+    if (((struct jif *)netif->state)->nic)
+	netif->offload = 0;
 
     // MAC address is hardcoded to eliminate a system call
     netif->hwaddr[0] = 0x52;
@@ -69,6 +95,59 @@ low_level_init(struct netif *netif)
     netif->hwaddr[5] = 0x56;
 }
 
+/*
+ * nic_reclaim():
+ *
+ * Takes back the tx slots the card has sent.
+ *
+ */
+static void
+nic_reclaim(struct jif *jif)
+{
+    struct nic_rings *rings = NIC_RINGS(jif->nic);
+
+    while (jif->tx_clean != jif->tdt &&
+	   (rings->tx[jif->tx_clean].status & NIC_TXD_STAT_DD))
+	jif->tx_clean = (jif->tx_clean + 1) % NIC_TX_SLOTS;
+}
+
+/*
+ * nic_output():
+ *
+ * low_level_output() on our own rings: copies the frame into the next
+ * tx buffer.  jif_flush() hands the filled slots to the card.  One slot
+ * always stays empty, so that a full ring is not taken for an empty one.
+ *
+ */
+static err_t
+nic_output(struct netif *netif, struct pbuf *p)
+{
+    struct jif *jif = netif->state;
+    struct pbuf *q;
+    char *txbuf;
+    int txsize = 0;
+
+    if (p->tot_len > JIF_FRAME_MAX)
+	panic("oversized packet, txsize %d\n", p->tot_len);
+    for (;;) {
+	nic_reclaim(jif);
+	if ((jif->tx_next + 1) % NIC_TX_SLOTS != jif->tx_clean)
+	    break;
+	jif_flush(netif);
+	sys_yield();
+    }
+
+    txbuf = NIC_TX_BUF(jif->nic, jif->tx_next);
+    for (q = p; q != NULL; q = q->next) {
+	memcpy(&txbuf[txsize], q->payload, q->len);
+	txsize += q->len;
+    }
+    NIC_CTL(jif->nic)->tx_len[jif->tx_next] = txsize;
+    jif->tx_next = (jif->tx_next + 1) % NIC_TX_SLOTS;
+
+    return ERR_OK;
+}
+
 /*
  * low_level_output():
  *
@@ -76,17 +155,40 @@ low_level_init(struct netif *netif)
  * contained in the pbuf that is passed to the function. This pbuf
  * might be chained.
  *
+ * Packets are collected in a struct jif_batch at PKTMAP and go to the
+ * output env together, with one IPC, when its JIF_BATCH_PAGES pages are
+ * full or the network server calls jif_flush() before it blocks.  Pages
+ * are allocated as the batch grows, so that a batch of small packets
+ * still takes just one.
+ *
  */
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
-
-    struct jif *jif;
-    jif = netif->state;
+    struct jif *jif = netif->state;
+    struct jif_batch *batch = (struct jif_batch *)PKTMAP;
+    char *end;
+
+    if (jif->nic)
+	return nic_output(netif, p);
+    if (p->tot_len > ((p->flags & PBUF_FLAG_TSO) ? JIF_TSO_MAX : JIF_FRAME_MAX))
+	panic("oversized packet, txsize %d\n", p->tot_len);
+    if (jif->npkts &&
+	(char *)jif->next + sizeof(struct jif_pkt) + p->tot_len >
+	(char *)PKTMAP + JIF_BATCH_PAGES * PGSIZE)
+	jif_flush(netif);
+    if (jif->npkts == 0) {
+	jif->next = (struct jif_pkt *)batch->jb_data;
+	jif->end = (char *)PKTMAP;
+    }
+    end = (char *)jif->next + sizeof(struct jif_pkt) + p->tot_len;
+    for (; jif->end < end; jif->end += PGSIZE) {
+	/* fresh pages: the old ones may still be going out from the card */
+	int r = sys_page_alloc(0, jif->end, PTE_U|PTE_W|PTE_P);
+	if (r < 0)
+	    panic("jif: could not allocate page of memory");
+    }
+    struct jif_pkt *pkt = jif->next;
 
     char *txbuf = pkt->jp_data;
     int txsize = 0;
@@ -95,21 +197,68 @@ low_level_output(struct netif *netif, struct pbuf *p)
 	/* Send the data from the pbuf to the interface, one pbuf at a
 	   time. The size of the data in each pbuf is kept in the ->len
 	   variable. */
-
-	if (txsize + q->len > 2000)
-	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
 	memcpy(&txbuf[txsize], q->payload, q->len);
 	txsize += q->len;
     }
 
     pkt->jp_len = txsize;
-
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+    pkt->jp_flags = 0;
+    pkt->jp_mss = 0;
+    if (p->flags & PBUF_FLAG_CSUM_IP)
+	pkt->jp_flags |= JIF_CSUM_IP;
+    if (p->flags & PBUF_FLAG_CSUM_L4)
+	pkt->jp_flags |= JIF_CSUM_L4;
+    if (p->flags & PBUF_FLAG_TSO) {
+	pkt->jp_flags |= JIF_TSO;
+	pkt->jp_mss = p->tso_mss;
+    }
+    jif->next = JIF_PKT_NEXT(pkt);
+    jif->npkts++;
 
     return ERR_OK;
 }
 
+/*
+ * jif_flush():
+ *
+ * Sends the packets low_level_output() has collected, if any.  The
+ * pages after the first are mapped straight into the output env's
+ * window for this batch (see NSOUTPUT_VA); the IPC then carries the
+ * first.  The next batch gets fresh pages, so ours need not be unmapped.
+ * On our own rings, it moves the card's tx tail past them instead.
+ *
+ */
+void
+jif_flush(struct netif *netif)
+{
+    struct jif *jif = netif->state;
+    struct jif_batch *batch = (struct jif_batch *)PKTMAP;
+    char *dst, *va;
+    int r;
+
+    if (jif->nic) {
+	if (jif->tx_next == jif->tdt)
+	    return;
+	if ((r = sys_nic_kick(jif->rdt, jif->tx_next)) < 0)
+	    panic("jif: sys_nic_kick: %e", r);
+	jif->tdt = jif->tx_next;
+	return;
+    }
+    if (jif->npkts == 0)
+	return;
+    batch->jb_npkts = jif->npkts;
+    dst = (char *)NSOUTPUT_VA + jif->window * JIF_BATCH_PAGES * PGSIZE;
+    for (va = (char *)PKTMAP + PGSIZE; va < jif->end; va += PGSIZE) {
+	r = sys_page_map(0, va, jif->envid, dst + (va - (char *)PKTMAP),
+			 PTE_P|PTE_W|PTE_U);
+	if (r < 0)
+	    panic("jif: sys_page_map: %e", r);
+    }
+    ipc_send(jif->envid, NSREQ_OUTPUT_BATCH, (void *)batch, PTE_P|PTE_W|PTE_U);
+    jif->window = !jif->window;
+    jif->npkts = 0;
+}
+
 /*
  * low_level_input():
  *
@@ -118,18 +267,21 @@ low_level_output(struct netif *netif, struct pbuf *p)
  *
  */
 static struct pbuf *
-low_level_input(void *va)
+low_level_input(void *data, int len, int flags)
 {
-    struct jif_pkt *pkt = (struct jif_pkt *)va;
-    s16_t len = pkt->jp_len;
-
     struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
 
+    /* checksums the card has verified need not be checked again */
+    if (flags & JIF_CSUM_IP)
+	p->flags |= PBUF_FLAG_CSUM_IP;
+    if (flags & JIF_CSUM_L4)
+	p->flags |= PBUF_FLAG_CSUM_L4;
+
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
-    void *rxbuf = (void *) pkt->jp_data;
+    void *rxbuf = data;
     int copied = 0;
     struct pbuf *q;
     for (q = p; q != NULL; q = q->next) {
@@ -163,17 +315,15 @@ jif_output(struct netif *netif, struct pbuf *p,
 }
 
 /*
- * jif_input():
+ * jif_input_frame():
  *
- * This function should be called when a packet is ready to be read
- * from the interface. It uses the function low_level_input() that
- * should handle the actual reception of bytes from the network
- * interface.
+ * Hands one received frame to lwIP.  It uses the function
+ * low_level_input() to copy it out of the buffer it arrived in.
  *
  */
 
-void
-jif_input(struct netif *netif, void *va)
+static void
+jif_input_frame(struct netif *netif, void *data, int len, int flags)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
@@ -182,7 +332,7 @@ jif_input(struct netif *netif, void *va)
     jif = netif->state;
   
     /* move received packet into a new pbuf */
-    p = low_level_input(va);
+    p = low_level_input(data, len, flags);
 
     /* no packet could be read, silently ignore this */
     if (p == NULL) return;
@@ -209,6 +359,78 @@ jif_input(struct netif *netif, void *va)
     }
 }
 
+/*
+ * jif_input():
+ *
+ * This function should be called when a packet is ready to be read
+ * from the interface, in the struct jif_pkt at va.
+ *
+ */
+
+void
+jif_input(struct netif *netif, void *va)
+{
+    struct jif_pkt *pkt = (struct jif_pkt *)va;
+
+    jif_input_frame(netif, pkt->jp_data, pkt->jp_len, pkt->jp_flags);
+}
+
+/*
+ * nic_csum_flags():
+ *
+ * The JIF_CSUM_* flags for the checksums the card found good in the
+ * frame at rx descriptor d.
+ *
+ */
+static int
+nic_csum_flags(struct nic_rx_desc *d)
+{
+    int flags = 0;
+
+    if (d->status & NIC_RXD_STAT_IXSM)
+	return 0;
+    if ((d->status & NIC_RXD_STAT_IPCS) && !(d->errors & NIC_RXD_ERR_IPE))
+	flags |= JIF_CSUM_IP;
+    if ((d->status & NIC_RXD_STAT_TCPCS) && !(d->errors & NIC_RXD_ERR_TCPE))
+	flags |= JIF_CSUM_L4;
+    return flags;
+}
+
+/*
+ * jif_poll():
+ *
+ * Called when the card interrupts the network server that drives its
+ * rings: takes back the tx slots it has sent, passes every frame it has
+ * received to lwIP and gives their rx slots back to it.
+ *
+ */
+void
+jif_poll(struct netif *netif)
+{
+    struct jif *jif = netif->state;
+    struct nic_rx_desc *d;
+    int n, r;
+
+    if (!jif->nic)
+	return;
+    nic_reclaim(jif);
+    /* the slot at the tail is ours, and may hold a stale frame */
+    for (n = 0; jif->rx_next != jif->rdt; n++) {
+	d = &NIC_RINGS(jif->nic)->rx[jif->rx_next];
+	if (!(d->status & NIC_RXD_STAT_DD))
+	    break;
+	if (d->status & NIC_RXD_STAT_EOP)
+	    jif_input_frame(netif, NIC_RX_BUF(jif->nic, jif->rx_next),
+			    MIN(d->length, NIC_BUF_SZ), nic_csum_flags(d));
+	jif->rx_next = (jif->rx_next + 1) % NIC_RX_SLOTS;
+    }
+    if (n == 0)
+	return;
+    jif->rdt = (jif->rdt + n) % NIC_RX_SLOTS;
+    if ((r = sys_nic_kick(jif->rdt, jif->tdt)) < 0)
+	panic("jif: sys_nic_kick: %e", r);
+}
+
 /*
  * jif_init():
  *
@@ -240,6 +462,20 @@ jif_init(struct netif *netif)
 
     jif->ethaddr = (struct eth_addr *)&(netif->hwaddr[0]);
     jif->envid = *output_envid; 
+    jif->npkts = 0;
+    jif->window = 0;
+    jif->nic = NULL;
+
+#ifdef NS_NICMAP
+    /* take the card over; it wakes us with NSREQ_NIC */
+    int r = sys_nic_map((void *)NICMAP, NSREQ_NIC);
+    if (r < 0)
+	panic("jif: sys_nic_map: %e", r);
+    jif->nic = (char *)NICMAP;
+    jif->rx_next = 0;
+    jif->rdt = NIC_RX_SLOTS - 1;
+    jif->tx_next = jif->tx_clean = jif->tdt = 0;
+#endif
 
     low_level_init(netif);
 
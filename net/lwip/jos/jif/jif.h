@@ -2,3 +2,5 @@
 
 void	jif_input(struct netif *netif, void *va);
 err_t	jif_init(struct netif *netif);
+void	jif_flush(struct netif *netif);
+void	jif_poll(struct netif *netif);
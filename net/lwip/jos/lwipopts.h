@@ -6,6 +6,7 @@
 // here to make it lwip visible. I am hiding lwip because JOS seems to want to
 // do so. There is a declaration of memcpy in JOS but not a definition.
 #include <inc/types.h>
+#include <inc/netpkt.h>
 void *memcpy(void *dst, const void *src, size_t n);
 
 //#define NO_SYS 1
@@ -22,7 +23,7 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 #define MEM_ALIGNMENT		4
 
-#define MEMP_NUM_PBUF		64
+#define MEMP_NUM_PBUF		128	// also the PBUF_REFs of TSO runs
 #define MEMP_NUM_UDP_PCB	8
 #define MEMP_NUM_TCP_PCB	32
 #define MEMP_NUM_TCP_PCB_LISTEN	16
@@ -37,9 +38,11 @@ void *memcpy(void *dst, const void *src, size_t n);
 #define PBUF_POOL_SIZE		512
 #define PBUF_POOL_BUFSIZE	2000
 
-#define TCP_MSS			1460
-#define TCP_WND			24000
-#define TCP_SND_BUF		(16 * TCP_MSS)
+// segments fill the interface's MTU (JIF_MTU); the windows are counted
+// in u16_t, so with jumbo frames they hold fewer of them
+#define TCP_MSS			(JIF_MTU - 40)
+#define TCP_WND			(4 * TCP_MSS > 24000 ? 4 * TCP_MSS : 24000)
+#define TCP_SND_BUF		(TCP_MSS > 4000 ? 7 * TCP_MSS : 16 * TCP_MSS)
 // lwip prints a warning if TCP_SND_QUEUELEN < (2 * TCP_SND_BUF/TCP_MSS), 
 // but 16 is faster.. 
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
@@ -956,6 +956,10 @@ etharp_query(struct netif *netif, struct ip_addr *ipaddr, struct pbuf *q)
           if (pbuf_copy(p, q) != ERR_OK) {
             pbuf_free(p);
             p = NULL;
+          } else {
+            /* the headers were filled in for q's offloads */
+            p->flags = q->flags;
+            p->tso_mss = q->tso_mss;
           }
         }
       } else {
@@ -15,7 +15,7 @@
 void timer(envid_t ns_envid, uint32_t initial_to);
 
 /* input.c */
-void input(envid_t ns_envid);
+void input(envid_t ns_envid, int rxq);
 
 /* output.c */
 void output(envid_t ns_envid);
@@ -1,23 +1,50 @@
 #include "ns.h"
 
-extern union Nsipc nsipcbuf;
-
 void
 output(envid_t ns_envid)
 {
 	binaryname = "ns_output";
-	int val;
+	int val, i, n, r, window = 0;
 	envid_t from;
+	const struct jif_pkt *pkt;
+	union Nsipc *req;
 
 	// LAB 6: Your code here:
 	// 	- read a packet from the network server
 	//	- send the packet to the device driver
 	while (1) {
-		val = ipc_recv(&from, &nsipcbuf, 0);
-		if (val != NSREQ_OUTPUT)
+		req = (union Nsipc *) (NSOUTPUT_VA
+				       + window * JIF_BATCH_PAGES * PGSIZE);
+		val = ipc_recv(&from, req, 0);
+		if (val != NSREQ_OUTPUT && val != NSREQ_OUTPUT_BATCH)
 			continue;
 		if (from != ns_envid)
 			panic("from != ns");
-		sys_tx_data(nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len);
+		// the kernel never waits for the card; when the tx ring is
+		// full, block in sys_tx_wait until it has sent something
+		if (val == NSREQ_OUTPUT) {
+			while ((r = sys_tx_data(req->pkt.jp_data,
+						req->pkt.jp_len)) == -E_AGAIN)
+				sys_tx_wait();
+			continue;
+		}
+		// hand the card as much of the batch as fits at a time; the
+		// network server has mapped the rest of its pages after
+		// this one, and puts the next batch in the other window
+		window = !window;
+		pkt = (const struct jif_pkt *) req->batch.jb_data;
+		for (n = req->batch.jb_npkts; n > 0; n -= r) {
+			if ((r = sys_tx_batch(pkt, n)) == -E_AGAIN) {
+				sys_tx_wait();
+				r = 0;
+				continue;
+			}
+			if (r < 0) {
+				cprintf("ns_output: sys_tx_batch: %e\n", r);
+				break;
+			}
+			for (i = 0; i < r; i++)
+				pkt = JIF_PKT_NEXT(pkt);
+		}
 	}
 }
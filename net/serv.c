@@ -234,6 +234,18 @@ serve_thread(uint32_t a) {
 		jif_input(&nif, (void *)&req->pkt);
 		r = 0;
 		break;
+	case NSREQ_INPUT_BATCH:
+	{
+		struct jif_pkt *pkt = (struct jif_pkt *)req->batch.jb_data;
+		int i;
+
+		for (i = 0; i < req->batch.jb_npkts; i++) {
+			jif_input(&nif, (void *)pkt);
+			pkt = JIF_PKT_NEXT(pkt);
+		}
+		r = 0;
+		break;
+	}
 	default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
 		r = -E_INVAL;
@@ -246,7 +258,7 @@ serve_thread(uint32_t a) {
 		perror(buf);
 	}
 
-	if (args->reqno != NSREQ_INPUT)
+	if (args->reqno != NSREQ_INPUT && args->reqno != NSREQ_INPUT_BATCH)
 		ipc_send(args->whom, r, 0, 0);
 
 	put_buffer(args->req);
@@ -254,6 +266,30 @@ serve_thread(uint32_t a) {
 	free(args);
 }
 
+// Take in the NSREQ_INPUT packet at 'va' from 'whom', which runs on into
+// more pages than the one that came with the request (see NSINPUT_VA).
+// This happens at once, so that 'whom' can have its pages back.
+static void
+input_long(envid_t whom, void *va)
+{
+	char *win = (char *) NSINPUT_VA;
+	int i, n, r;
+
+	n = MIN(JIF_PKT_PAGES((struct jif_pkt *) va), JIF_BATCH_PAGES);
+	r = sys_page_map(0, va, 0, win, PTE_P|PTE_U);
+	for (i = 1; i < n && r >= 0; i++)
+		r = sys_page_map(whom, win + i * PGSIZE, 0, win + i * PGSIZE,
+				 PTE_P|PTE_U);
+	if (r >= 0 && i == JIF_PKT_PAGES((struct jif_pkt *) va))
+		jif_input(&nif, win);
+	else
+		cprintf("ns: dropping a %d-byte packet: %e\n",
+			((struct jif_pkt *) va)->jp_len, r < 0 ? r : -E_INVAL);
+	for (i = 0; i < n; i++)
+		sys_page_unmap(0, win + i * PGSIZE);
+	ipc_send(whom, 0, 0, 0);
+}
+
 void
 serve(void) {
 	int32_t reqno;
@@ -267,6 +303,8 @@ serve(void) {
 		// number of yields in case there's a rogue thread.
 		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
 			thread_yield();
+		// and hand the packets they queued to the output env
+		jif_flush(&nif);
 
 		perm = 0;
 		va = get_buffer();
@@ -282,12 +320,26 @@ serve(void) {
 			continue;
 		}
 
+		if (reqno == NSREQ_NIC) {
+			jif_poll(&nif);
+			put_buffer(va);
+			continue;
+		}
+
 		// All remaining requests must contain an argument page
 		if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n", whom);
 			continue; // just leave it hanging...
 		}
 
+		if (reqno == NSREQ_INPUT &&
+		    JIF_PKT_PAGES((struct jif_pkt *) va) > 1) {
+			input_long(whom, va);
+			put_buffer(va);
+			sys_page_unmap(0, va);
+			continue;
+		}
+
 		// Since some lwIP socket calls will block, create a thread and
 		// process the rest of the request in the thread.
 		struct st_args *args = malloc(sizeof(struct st_args));
@@ -315,6 +367,7 @@ void
 umain(int argc, char **argv)
 {
 	envid_t ns_envid = sys_getenvid();
+	int q, nrxq;
 
 	binaryname = "ns";
 
@@ -327,14 +380,20 @@ umain(int argc, char **argv)
 		return;
 	}
 
-	// fork off the input thread which will poll the NIC driver for input
-	// packets
-	input_envid = fork();
-	if (input_envid < 0)
-		panic("error forking");
-	else if (input_envid == 0) {
-		input(ns_envid);
-		return;
+#ifndef NS_NICMAP
+	// fork off the input threads which will poll the NIC driver for
+	// input packets, one for each of its receive queues; the driver
+	// spreads flows over the queues, and each thread runs on a CPU of
+	// its own
+	nrxq = sys_rx_bind(-1);
+	for (q = 0; q < nrxq; q++) {
+		input_envid = fork();
+		if (input_envid < 0)
+			panic("error forking");
+		else if (input_envid == 0) {
+			input(ns_envid, q);
+			return;
+		}
 	}
 
 	// fork off the output thread that will send the packets to the NIC
@@ -346,6 +405,7 @@ umain(int argc, char **argv)
 		output(ns_envid);
 		return;
 	}
+#endif
 
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization.
@@ -84,7 +84,7 @@ umain(int argc, char **argv)
 	if (input_envid < 0)
 		panic("error forking");
 	else if (input_envid == 0) {
-		input(ns_envid);
+		input(ns_envid, 0);
 		return;
 	}
 
@@ -100,11 +100,23 @@ umain(int argc, char **argv)
 			panic("ipc_recv: %e", req);
 		if (whom != input_envid)
 			panic("IPC from unexpected environment %08x", whom);
-		if (req != NSREQ_INPUT)
+		if (req != NSREQ_INPUT && req != NSREQ_INPUT_BATCH)
 			panic("Unexpected IPC %d", req);
 
-		hexdump("input: ", pkt->jp_data, pkt->jp_len);
-		cprintf("\n");
+		if (req == NSREQ_INPUT) {
+			hexdump("input: ", pkt->jp_data, pkt->jp_len);
+			cprintf("\n");
+		} else {
+			struct jif_batch *batch = (struct jif_batch *)pkt;
+			struct jif_pkt *p = (struct jif_pkt *)batch->jb_data;
+			int i;
+
+			for (i = 0; i < batch->jb_npkts; i++) {
+				hexdump("input: ", p->jp_data, p->jp_len);
+				cprintf("\n");
+				p = JIF_PKT_NEXT(p);
+			}
+		}
 
 		// Only indicate that we're waiting for packets once
 		// we've received the ARP reply
@@ -0,0 +1,168 @@
+#!/usr/bin/env python
+
+# Host-side load generator for user/netbench.
+#
+# Talks to netbench through the ports the GNUmakefile forwards to JOS
+# port 7 (see "make which-ports") and measures, from the host:
+#	tcp_tx		bulk TCP from JOS to the host, in KB/s
+#	tcp_rx		bulk TCP from the host to JOS, in KB/s
+#	tcp_rr		request/response transactions per second
+#	tcp_connect	connections set up and torn down per second
+#	udp_rx		UDP datagrams per second that reached netbench
+#
+# bench-run drives it with "./bench-run -p netbench"; to use it on its
+# own, start "make run-netbench-nox" and run "./netload.py".
+
+from __future__ import print_function
+
+import sys, time, socket, struct
+from optparse import OptionParser
+
+READY = r"^netbench: ready"
+
+# Seconds any one socket operation may block
+TIMEOUT = 10
+
+def connect(host, port, cmd):
+    s = socket.create_connection((host, port), TIMEOUT)
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    s.sendall(cmd)
+    return s
+
+def recv_exact(s, n):
+    data = bytearray()
+    while len(data) < n:
+        chunk = s.recv(n - len(data))
+        if not chunk:
+            raise IOError('netbench closed the connection')
+        data += chunk
+    return bytes(data)
+
+def recv_u32(s):
+    return struct.unpack('!I', recv_exact(s, 4))[0]
+
+def tcp_tx(opts):
+    s = connect(opts.host, opts.port, b'T' + struct.pack('!I', opts.bytes))
+    got, start = 0, time.time()
+    while got < opts.bytes:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        got += len(chunk)
+    elapsed = time.time() - start
+    s.close()
+    if got != opts.bytes:
+        raise IOError('tcp_tx: got %d of %d bytes' % (got, opts.bytes))
+    return got / 1024.0 / elapsed, 'KB/s'
+
+def tcp_rx(opts):
+    s = connect(opts.host, opts.port, b'S')
+    block = b'x' * 16384
+    start, sent = time.time(), 0
+    while sent < opts.bytes:
+        n = min(len(block), opts.bytes - sent)
+        s.sendall(block[:n])
+        sent += n
+    s.shutdown(socket.SHUT_WR)
+    total = recv_u32(s)
+    elapsed = time.time() - start
+    s.close()
+    if total != sent:
+        raise IOError('tcp_rx: netbench got %d of %d bytes' % (total, sent))
+    return sent / 1024.0 / elapsed, 'KB/s'
+
+def tcp_rr(opts):
+    s = connect(opts.host, opts.port, b'R' + struct.pack('!I', opts.size))
+    msg = b'r' * opts.size
+    n, start = 0, time.time()
+    while time.time() - start < opts.duration:
+        s.sendall(msg)
+        recv_exact(s, opts.size)
+        n += 1
+    elapsed = time.time() - start
+    s.close()
+    return n / elapsed, 'trans/s'
+
+def tcp_connect(opts):
+    n, start = 0, time.time()
+    while time.time() - start < opts.duration:
+        s = connect(opts.host, opts.port, b'C')
+        # netbench closes first, so the TIME_WAIT state stays on its side
+        s.recv(1)
+        s.close()
+        n += 1
+    return n / (time.time() - start), 'conn/s'
+
+def udp_count(opts):
+    s = connect(opts.host, opts.port, b'U')
+    n = recv_u32(s)
+    s.close()
+    return n
+
+def udp_rx(opts):
+    before = udp_count(opts)
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    msg = b'u' * opts.size
+    sent, start = 0, time.time()
+    while time.time() - start < opts.duration:
+        s.sendto(msg, (opts.host, opts.udp_port))
+        sent += 1
+    elapsed = time.time() - start
+    s.close()
+    # Let the stragglers drain before counting
+    time.sleep(0.5)
+    got = udp_count(opts) - before
+    if opts.verbose:
+        print('udp_rx: %d of %d datagrams arrived' % (got, sent))
+    return got / elapsed, 'pkts/s'
+
+TESTS = [('tcp_tx', tcp_tx), ('tcp_rx', tcp_rx), ('tcp_rr', tcp_rr),
+         ('tcp_connect', tcp_connect), ('udp_rx', udp_rx)]
+
+def run(opts):
+    """Run every test in opts.tests (all if empty) and return a dict of
+    name -> (value, unit)."""
+
+    results = {}
+    for name, fn in TESTS:
+        if opts.tests and name not in opts.tests:
+            continue
+        value, unit = fn(opts)
+        results[name] = (int(value), unit)
+    return results
+
+def add_options(parser):
+    parser.add_option('--host', default='127.0.0.1',
+                      help='address QEMU forwards from [%default]')
+    parser.add_option('--bytes', type='int', default=4 << 20,
+                      help='bytes per bulk transfer [%default]')
+    parser.add_option('--size', type='int', default=64,
+                      help='request/response and datagram size [%default]')
+    parser.add_option('--duration', type='float', default=3,
+                      help='seconds per timed test [%default]')
+    parser.add_option('--test', dest='tests', action='append', default=[],
+                      help='run only this test (repeatable)')
+
+def main():
+    parser = OptionParser(usage='usage: %prog [options]')
+    add_options(parser)
+    parser.add_option('--port', type='int',
+                      help='host TCP port forwarded to JOS port 7 '
+                      '[GDB port + 1]')
+    parser.add_option('--udp-port', type='int',
+                      help='host UDP port forwarded to JOS port 7 [--port]')
+    parser.add_option('-v', '--verbose', action='store_true')
+    opts, args = parser.parse_args()
+    if opts.port is None:
+        import gradelib
+        opts.port = gradelib.QEMU.get_gdb_port() + 1
+    opts.udp_port = opts.udp_port or opts.port
+
+    results = run(opts)
+    for name, _ in TESTS:
+        if name in results:
+            print('BENCH %s %d %s' % (name, results[name][0],
+                                      results[name][1]))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,293 @@
+// Microbenchmarks of kernel primitives, timed with the TSC.
+//
+//	bench [name...]
+//
+// Runs the named benchmarks, or all of them, and prints one line per
+// result for bench-run to collect:
+//	BENCH <name> <value> <unit>
+// followed by "BENCH done".  Every value is a mean and lower is better.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define PAGES	((char *) 0x10000000)	// Scratch area for page benchmarks
+#define PAGES2	((char *) 0x20000000)
+#define IPCPAGE	((char *) 0x30000000)
+#define PERM	(PTE_P|PTE_U|PTE_W)
+
+static uint64_t bench_t0;
+
+static void
+bench_start(void)
+{
+	bench_t0 = read_tsc();
+}
+
+static void
+bench_stop(const char *name, int n, const char *unit)
+{
+	uint64_t cycles = read_tsc() - bench_t0;
+
+	cprintf("BENCH %s %u %s\n", name, (uint32_t) (cycles / n), unit);
+}
+
+// Fork a child that runs fn() and then exits.
+static envid_t
+bench_fork(void (*fn)(void))
+{
+	envid_t child;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		fn();
+		exit();
+	}
+	return child;
+}
+
+// Block until the parent sends anything.
+static void
+child_park(void)
+{
+	ipc_recv(0, 0, 0);
+}
+
+static void
+child_yield(void)
+{
+	while (1)
+		sys_yield();
+}
+
+static void
+child_echo(void)
+{
+	envid_t from;
+	uint32_t v;
+	int perm;
+
+	while (1) {
+		v = ipc_recv(&from, IPCPAGE, &perm);
+		ipc_send(from, v, perm ? IPCPAGE : 0, perm);
+	}
+}
+
+static void
+alloc_pages(char *va, int n)
+{
+	int i, r;
+
+	for (i = 0; i < n; i++)
+		if ((r = sys_page_alloc(0, va + i * PGSIZE, PERM)) < 0)
+			panic("sys_page_alloc: %e", r);
+}
+
+static void
+unmap_pages(char *va, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		sys_page_unmap(0, va + i * PGSIZE);
+}
+
+static void
+bench_null_syscall(void)
+{
+	int i, n = 10000;
+
+	bench_start();
+	for (i = 0; i < n; i++)
+		sys_getenvid();
+	bench_stop("null_syscall", n, "cycles");
+}
+
+static void
+bench_yield(void)
+{
+	int i, n = 2000;
+	envid_t child = bench_fork(child_yield);
+
+	// Let the child start spinning
+	sys_yield();
+	bench_start();
+	for (i = 0; i < n; i++)
+		sys_yield();
+	bench_stop("yield", n, "cycles");
+	sys_env_destroy(child);
+}
+
+static void
+bench_ipc(void)
+{
+	int i, n = 2000;
+	envid_t child = bench_fork(child_echo);
+
+	bench_start();
+	for (i = 0; i < n; i++) {
+		ipc_send(child, i, 0, 0);
+		ipc_recv(0, 0, 0);
+	}
+	bench_stop("ipc_pingpong", n, "cycles");
+
+	alloc_pages(IPCPAGE, 1);
+	bench_start();
+	for (i = 0; i < n; i++) {
+		ipc_send(child, i, IPCPAGE, PERM);
+		ipc_recv(0, IPCPAGE, 0);
+	}
+	bench_stop("ipc_pingpong_page", n, "cycles");
+	unmap_pages(IPCPAGE, 1);
+	sys_env_destroy(child);
+}
+
+static void
+bench_page(void)
+{
+	int i, r, n = 512;
+
+	bench_start();
+	alloc_pages(PAGES, n);
+	bench_stop("page_alloc", n, "cycles");
+
+	bench_start();
+	for (i = 0; i < n; i++)
+		if ((r = sys_page_map(0, PAGES + i * PGSIZE,
+				      0, PAGES2 + i * PGSIZE, PERM)) < 0)
+			panic("sys_page_map: %e", r);
+	bench_stop("page_map", n, "cycles");
+
+	bench_start();
+	unmap_pages(PAGES2, n);
+	bench_stop("page_unmap", n, "cycles");
+	unmap_pages(PAGES, n);
+}
+
+static void
+bench_fork_pages(void)
+{
+	static const int sizes[] = { 0, 64, 512 };
+	char name[32];
+	int i, j, n = 10;
+	uint64_t cycles;
+	envid_t child;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		alloc_pages(PAGES, sizes[i]);
+		cycles = 0;
+		for (j = 0; j < n; j++) {
+			bench_start();
+			child = bench_fork(child_park);
+			cycles += read_tsc() - bench_t0;
+			ipc_send(child, 0, 0, 0);
+			wait(child);
+		}
+		snprintf(name, sizeof(name), "fork_%dpages", sizes[i]);
+		cprintf("BENCH %s %u cycles\n", name, (uint32_t) (cycles / n));
+		unmap_pages(PAGES, sizes[i]);
+	}
+}
+
+static void
+bench_spawn(void)
+{
+	int i, r, n = 10;
+
+	bench_start();
+	for (i = 0; i < n; i++) {
+		if ((r = spawnl("true", "true", (char *) 0)) < 0)
+			panic("spawn: %e", r);
+		wait(r);
+	}
+	bench_stop("spawn", n, "cycles");
+}
+
+#define PIPE_TOTAL	(256 * 1024)
+#define PIPE_CHUNK	4096
+
+static int pipe_fd[2];
+
+static void
+child_pipe_writer(void)
+{
+	static char buf[PIPE_CHUNK];
+	int i, r;
+
+	close(pipe_fd[0]);
+	for (i = 0; i < PIPE_TOTAL; i += PIPE_CHUNK)
+		if ((r = write(pipe_fd[1], buf, PIPE_CHUNK)) != PIPE_CHUNK)
+			panic("pipe write: %e", r);
+	close(pipe_fd[1]);
+}
+
+static void
+bench_pipe(void)
+{
+	static char buf[PIPE_CHUNK];
+	int r, total = 0;
+	envid_t child;
+
+	if ((r = pipe(pipe_fd)) < 0)
+		panic("pipe: %e", r);
+	bench_start();
+	child = bench_fork(child_pipe_writer);
+	close(pipe_fd[1]);
+	while ((r = read(pipe_fd[0], buf, sizeof(buf))) > 0)
+		total += r;
+	if (r < 0 || total != PIPE_TOTAL)
+		panic("pipe read: %e, %d bytes", r, total);
+	bench_stop("pipe", PIPE_TOTAL / 1024, "cycles/KB");
+	close(pipe_fd[0]);
+	wait(child);
+}
+
+static void
+bench_cow(void)
+{
+	int i, n = 256;
+	envid_t child;
+
+	alloc_pages(PAGES, n);
+	for (i = 0; i < n; i++)
+		PAGES[i * PGSIZE] = 1;
+	// While the child lives, every page of ours is copy-on-write
+	child = bench_fork(child_park);
+	bench_start();
+	for (i = 0; i < n; i++)
+		PAGES[i * PGSIZE] = 2;
+	bench_stop("cow_fault", n, "cycles");
+	ipc_send(child, 0, 0, 0);
+	wait(child);
+	unmap_pages(PAGES, n);
+}
+
+static struct {
+	const char *name;
+	void (*fn)(void);
+} benches[] = {
+	{ "null_syscall", bench_null_syscall },
+	{ "yield", bench_yield },
+	{ "ipc", bench_ipc },
+	{ "page", bench_page },
+	{ "fork", bench_fork_pages },
+	{ "spawn", bench_spawn },
+	{ "pipe", bench_pipe },
+	{ "cow", bench_cow },
+};
+
+void
+umain(int argc, char **argv)
+{
+	int i, j;
+
+	binaryname = "bench";
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		for (j = 1; j < argc; j++)
+			if (strcmp(argv[j], benches[i].name) == 0)
+				break;
+		if (argc == 1 || j < argc)
+			benches[i].fn();
+	}
+	cprintf("BENCH done\n");
+}
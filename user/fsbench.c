@@ -0,0 +1,339 @@
+// File system throughput and latency benchmarks.
+//
+//	fsbench [-s kbytes] [-n files] [name...]
+//
+// Meant to run on a fresh fs.img: it creates /fsb.data (-s KB, default
+// 1024) and -n small files (default 256) in the root directory, and
+// the file server cannot remove them again.  Results go to the console
+// in the format bench-run collects, one per line:
+//	BENCH <name> <value> <unit>
+// Throughputs are in KB/s; per-operation latencies are the 50th, 90th
+// and 99th percentiles in nanoseconds, converted from the TSC with a
+// rate measured against sys_time_msec at startup.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define DATAFILE	"/fsb.data"
+#define MAXOPS		8192
+
+static const int block_sizes[] = { 512, 4096, 32768 };
+
+static uint32_t file_kb = 1024;
+static int nfiles = 256;
+static uint32_t tsc_per_us;
+
+static char buf[32768];
+static uint32_t lat[MAXOPS];	// Cycles taken by each operation
+static int nlat;
+
+// Count TSC cycles across 100ms of the kernel's clock.
+static void
+calibrate(void)
+{
+	unsigned int t;
+	uint64_t tsc;
+
+	t = sys_time_msec();
+	while (sys_time_msec() == t)
+		/* wait for a tick edge */;
+	tsc = read_tsc();
+	t = sys_time_msec();
+	while (sys_time_msec() < t + 100)
+		sys_yield();
+	tsc_per_us = (read_tsc() - tsc) / 100000;
+	if (tsc_per_us == 0)
+		tsc_per_us = 1;
+}
+
+static uint32_t
+cycles_to_ns(uint64_t cycles)
+{
+	return cycles * 1000 / tsc_per_us;
+}
+
+static void
+lat_reset(void)
+{
+	nlat = 0;
+}
+
+static void
+lat_add(uint64_t cycles)
+{
+	if (nlat < MAXOPS)
+		lat[nlat++] = cycles;
+}
+
+static void
+lat_sort(void)
+{
+	int gap, i, j;
+	uint32_t v;
+
+	for (gap = nlat / 2; gap > 0; gap /= 2)
+		for (i = gap; i < nlat; i++) {
+			v = lat[i];
+			for (j = i; j >= gap && lat[j - gap] > v; j -= gap)
+				lat[j] = lat[j - gap];
+			lat[j] = v;
+		}
+}
+
+static void
+report_latency(const char *name)
+{
+	static const int pcts[] = { 50, 90, 99 };
+	int i;
+
+	if (!nlat)
+		return;
+	lat_sort();
+	for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+		cprintf("BENCH %s_p%d %u ns\n", name, pcts[i],
+			cycles_to_ns(lat[nlat * pcts[i] / 100]));
+}
+
+static void
+report_rate(const char *name, uint32_t kb, uint64_t cycles)
+{
+	uint64_t us = cycles / tsc_per_us;
+
+	cprintf("BENCH %s %u KB/s\n", name,
+		(uint32_t) ((uint64_t) kb * 1000000 / (us ? us : 1)));
+}
+
+// write() to a file may be short, so loop like readn().
+static int
+writen(int fd, const void *data, int n)
+{
+	int m, tot;
+
+	for (tot = 0; tot < n; tot += m)
+		if ((m = write(fd, (const char *) data + tot, n - tot)) <= 0)
+			return m < 0 ? m : tot;
+	return tot;
+}
+
+static int
+xopen(const char *path, int mode)
+{
+	int fd;
+
+	if ((fd = open(path, mode)) < 0)
+		panic("open %s: %e", path, fd);
+	return fd;
+}
+
+// Time a pass of 'bs'-byte reads or writes over the whole data file, at
+// sequential or pseudo-random 'bs'-aligned offsets.
+static void
+bench_rw(const char *what, int bs, bool writing, bool random)
+{
+	char name[32];
+	uint32_t nblocks = file_kb * 1024 / bs, seed = 1;
+	uint64_t t0, start;
+	int fd, i, r;
+
+	fd = xopen(DATAFILE, writing ? O_RDWR : O_RDONLY);
+	lat_reset();
+	start = read_tsc();
+	for (i = 0; i < nblocks; i++) {
+		t0 = read_tsc();
+		if (random) {
+			seed = seed * 1103515245 + 12345;
+			seek(fd, (seed >> 8) % nblocks * bs);
+		}
+		if (writing)
+			r = writen(fd, buf, bs);
+		else
+			r = readn(fd, buf, bs);
+		if (r != bs)
+			panic("%s %d: %e", what, bs, r);
+		lat_add(read_tsc() - t0);
+	}
+	snprintf(name, sizeof(name), "fs_%s_%d", what, bs);
+	report_rate(name, file_kb, read_tsc() - start);
+	report_latency(name);
+	close(fd);
+}
+
+static void
+bench_seq(void)
+{
+	int i, fd;
+
+	for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+		// Start each write pass from an empty file, so it allocates
+		fd = xopen(DATAFILE, O_WRONLY | O_CREAT | O_TRUNC);
+		close(fd);
+		bench_rw("seqwrite", block_sizes[i], 1, 0);
+		bench_rw("seqread", block_sizes[i], 0, 0);
+	}
+}
+
+static void
+bench_rand(void)
+{
+	int i, fd;
+
+	// Random I/O stays within a file of full size
+	if ((fd = open(DATAFILE, O_RDONLY)) >= 0)
+		close(fd);
+	else {
+		close(xopen(DATAFILE, O_WRONLY | O_CREAT));
+		bench_rw("seqwrite", 4096, 1, 0);
+	}
+	for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+		bench_rw("randwrite", block_sizes[i], 1, 1);
+		bench_rw("randread", block_sizes[i], 0, 1);
+	}
+}
+
+static void
+file_name(char *name, int i)
+{
+	snprintf(name, MAXNAMELEN, "/fsb.%d", i);
+}
+
+// Creating, opening and stat'ing small files.  Each op is a full
+// open (and close) round trip to the file server.
+static void
+bench_meta(void)
+{
+	char name[MAXNAMELEN];
+	struct Stat st;
+	uint64_t t0;
+	int i, fd;
+
+	lat_reset();
+	for (i = 0; i < nfiles; i++) {
+		file_name(name, i);
+		t0 = read_tsc();
+		if ((fd = open(name, O_WRONLY | O_CREAT | O_EXCL)) < 0) {
+			if (fd == -E_FILE_EXISTS)
+				panic("%s exists; run fsbench on a fresh fs.img",
+				      name);
+			panic("create %s: %e", name, fd);
+		}
+		close(fd);
+		lat_add(read_tsc() - t0);
+	}
+	report_latency("fs_create");
+
+	lat_reset();
+	for (i = 0; i < nfiles; i++) {
+		file_name(name, i);
+		t0 = read_tsc();
+		close(xopen(name, O_RDONLY));
+		lat_add(read_tsc() - t0);
+	}
+	report_latency("fs_open");
+
+	lat_reset();
+	for (i = 0; i < nfiles; i++) {
+		file_name(name, i);
+		t0 = read_tsc();
+		if (stat(name, &st) < 0)
+			panic("stat %s", name);
+		lat_add(read_tsc() - t0);
+	}
+	report_latency("fs_stat");
+
+	// Lookups that scan the whole root directory: misses, and the
+	// entry created last
+	lat_reset();
+	for (i = 0; i < nfiles; i++) {
+		snprintf(name, sizeof(name), "/fsb.missing.%d", i);
+		t0 = read_tsc();
+		if (stat(name, &st) != -E_NOT_FOUND)
+			panic("stat %s found", name);
+		lat_add(read_tsc() - t0);
+	}
+	report_latency("fs_lookup_miss");
+
+	lat_reset();
+	file_name(name, nfiles - 1);
+	for (i = 0; i < nfiles; i++) {
+		t0 = read_tsc();
+		if (stat(name, &st) < 0)
+			panic("stat %s", name);
+		lat_add(read_tsc() - t0);
+	}
+	report_latency("fs_lookup_last");
+}
+
+// Cost of sync with nothing to write, and with 'n' dirty blocks.
+static void
+bench_sync(void)
+{
+	uint64_t t0;
+	int i, fd, n = 64;
+
+	sync();
+	t0 = read_tsc();
+	sync();
+	cprintf("BENCH fs_sync_clean %u ns\n", cycles_to_ns(read_tsc() - t0));
+
+	fd = xopen(DATAFILE, O_RDWR | O_CREAT);
+	for (i = 0; i < n; i++)
+		if (writen(fd, buf, BLKSIZE) != BLKSIZE)
+			panic("write %s", DATAFILE);
+	close(fd);
+	t0 = read_tsc();
+	sync();
+	cprintf("BENCH fs_sync_%dblocks %u ns\n", n,
+		cycles_to_ns(read_tsc() - t0));
+}
+
+static struct {
+	const char *name;
+	void (*fn)(void);
+} benches[] = {
+	{ "seq", bench_seq },
+	{ "rand", bench_rand },
+	{ "meta", bench_meta },
+	{ "sync", bench_sync },
+};
+
+static void
+usage(void)
+{
+	cprintf("usage: fsbench [-s kbytes] [-n files] [seq|rand|meta|sync...]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Argstate args;
+	int i, j, ch;
+
+	binaryname = "fsbench";
+	argstart(&argc, argv, &args);
+	while ((ch = argnext(&args)) >= 0)
+		switch (ch) {
+		case 's':
+			file_kb = strtol(argvalue(&args), 0, 0);
+			break;
+		case 'n':
+			nfiles = strtol(argvalue(&args), 0, 0);
+			break;
+		default:
+			usage();
+		}
+	if (file_kb < 32 || file_kb * 1024 / block_sizes[0] > MAXOPS
+	    || file_kb * 1024 > MAXFILESIZE || nfiles < 1)
+		usage();
+
+	calibrate();
+	cprintf("fsbench: TSC runs at %u MHz\n", tsc_per_us);
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		for (j = 1; j < argc; j++)
+			if (strcmp(argv[j], benches[i].name) == 0)
+				break;
+		if (argc == 1 || j < argc)
+			benches[i].fn();
+	}
+	cprintf("BENCH done\n");
+}
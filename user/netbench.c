@@ -0,0 +1,184 @@
+// Network benchmark server, driven by the host script netload.py
+// (usually through "./bench-run -p netbench").
+//
+// Listens on TCP port 7 and UDP port 7, which the GNUmakefile forwards
+// from the host.  Each TCP connection starts with a one-byte command;
+// multi-byte integers are in network byte order:
+//	'S'		sink: read until EOF, then reply with the byte count
+//	'T' <n>		source: write n bytes, then close
+//	'R' <size>	request/response: echo size-byte messages until EOF
+//	'C'		connect: close at once
+//	'U'		reply with the number of UDP datagrams received so far
+// The host does all the timing; this side only has to keep up.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define PORT		7
+#define BUFSIZE		1024	// nsipc_send takes less than 1600 bytes
+#define MAXMSG		BUFSIZE
+
+// Counter shared with the UDP child, which fork leaves in place
+#define UDPCOUNT	((volatile uint32_t *) 0x10000000)
+
+static char buf[BUFSIZE];
+
+static void
+die(const char *m)
+{
+	cprintf("netbench: %s\n", m);
+	exit();
+}
+
+static int
+writen(int s, const void *data, int n)
+{
+	int m, tot;
+
+	for (tot = 0; tot < n; tot += m)
+		if ((m = write(s, (const char *) data + tot, n - tot)) <= 0)
+			return -1;
+	return 0;
+}
+
+static int
+read_u32(int s, uint32_t *v)
+{
+	if (readn(s, v, sizeof(*v)) != sizeof(*v))
+		return -1;
+	*v = ntohl(*v);
+	return 0;
+}
+
+static void
+write_u32(int s, uint32_t v)
+{
+	v = htonl(v);
+	writen(s, &v, sizeof(v));
+}
+
+static void
+do_sink(int s)
+{
+	uint32_t total = 0;
+	int r;
+
+	while ((r = read(s, buf, sizeof(buf))) > 0)
+		total += r;
+	write_u32(s, total);
+}
+
+static void
+do_source(int s)
+{
+	uint32_t n, m;
+
+	if (read_u32(s, &n) < 0)
+		return;
+	for (; n > 0; n -= m) {
+		m = MIN(n, sizeof(buf));
+		if (writen(s, buf, m) < 0)
+			return;
+	}
+}
+
+static void
+do_rr(int s)
+{
+	uint32_t size;
+
+	if (read_u32(s, &size) < 0 || size == 0 || size > MAXMSG)
+		return;
+	while (readn(s, buf, size) == size)
+		if (writen(s, buf, size) < 0)
+			return;
+}
+
+static void
+handle_client(int s)
+{
+	char cmd;
+
+	if (read(s, &cmd, 1) != 1)
+		return;
+	switch (cmd) {
+	case 'S':
+		do_sink(s);
+		break;
+	case 'T':
+		do_source(s);
+		break;
+	case 'R':
+		do_rr(s);
+		break;
+	case 'C':
+		break;
+	case 'U':
+		write_u32(s, *UDPCOUNT);
+		break;
+	default:
+		cprintf("netbench: bad command %02x\n", cmd);
+	}
+}
+
+static int
+bound_socket(int type, int proto)
+{
+	struct sockaddr_in addr;
+	int s;
+
+	if ((s = socket(PF_INET, type, proto)) < 0)
+		die("socket failed");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind failed");
+	return s;
+}
+
+// Count datagrams arriving on the UDP port.
+static void
+udp_counter(void)
+{
+	int s = bound_socket(SOCK_DGRAM, IPPROTO_UDP);
+
+	while (read(s, buf, sizeof(buf)) >= 0)
+		(*UDPCOUNT)++;
+	die("UDP read failed");
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in peer;
+	unsigned int peerlen;
+	int server, client, r;
+
+	binaryname = "netbench";
+	if ((r = sys_page_alloc(0, (void *) UDPCOUNT,
+				PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		udp_counter();
+		return;
+	}
+
+	server = bound_socket(SOCK_STREAM, IPPROTO_TCP);
+	if (listen(server, 5) < 0)
+		die("listen failed");
+	cprintf("netbench: ready\n");
+
+	while (1) {
+		peerlen = sizeof(peer);
+		if ((client = accept(server, (struct sockaddr *) &peer,
+				     &peerlen)) < 0)
+			die("accept failed");
+		handle_client(client);
+		close(client);
+	}
+}
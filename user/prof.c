@@ -0,0 +1,53 @@
+// Control the kernel's sampling profiler from the shell:
+//	prof start	discard old samples and start sampling
+//	prof stop	stop sampling
+//	prof dump	print and drain all samples
+// dump prints the same lines as the "prof dump" monitor command, so
+// the console log can be fed to prof-report on the host.
+
+#include <inc/lib.h>
+
+#define NBUF	64
+
+static struct ProfSample buf[NBUF];
+
+static void
+dump(void)
+{
+	int n, i, j;
+
+	while ((n = sys_prof(PROF_READ, buf, NBUF)) > 0)
+		for (i = 0; i < n; i++) {
+			printf("prof %d %08x %d %c", buf[i].ps_cpu,
+			       buf[i].ps_envid, buf[i].ps_envtype,
+			       buf[i].ps_user ? 'u' : 'k');
+			for (j = 0; j < buf[i].ps_depth; j++)
+				printf(" %08x", buf[i].ps_pc[j]);
+			printf("\n");
+		}
+	if (n < 0)
+		panic("sys_prof: %e", n);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r;
+
+	if (argc != 2)
+		goto usage;
+	if (strcmp(argv[1], "start") == 0) {
+		if ((r = sys_prof(PROF_START, 0, 0)) < 0)
+			panic("sys_prof: %e", r);
+	} else if (strcmp(argv[1], "stop") == 0)
+		sys_prof(PROF_STOP, 0, 0);
+	else if (strcmp(argv[1], "dump") == 0)
+		dump();
+	else
+		goto usage;
+	return;
+
+usage:
+	printf("usage: prof start|stop|dump\n");
+	exit();
+}
@@ -0,0 +1,83 @@
+// Print per-syscall counts and latency histograms.
+//	sysstat [-r] [envid]
+// Shows the system-wide statistics, or those of one environment;
+// -r clears them after printing.  Each histogram bucket is printed as
+// "2^k:n": n calls took between 2^k and 2^(k+1) TSC cycles.
+
+#include <inc/lib.h>
+
+static const char * const names[NSYSCALLS] = {
+	[SYS_cputs] = "cputs",
+	[SYS_cgetc] = "cgetc",
+	[SYS_getenvid] = "getenvid",
+	[SYS_env_destroy] = "env_destroy",
+	[SYS_page_alloc] = "page_alloc",
+	[SYS_page_map] = "page_map",
+	[SYS_page_unmap] = "page_unmap",
+	[SYS_exofork] = "exofork",
+	[SYS_env_set_status] = "env_set_status",
+	[SYS_env_set_trapframe] = "env_set_trapframe",
+	[SYS_env_set_pgfault_upcall] = "env_set_pgfault_upcall",
+	[SYS_yield] = "yield",
+	[SYS_ipc_try_send] = "ipc_try_send",
+	[SYS_ipc_recv] = "ipc_recv",
+	[SYS_time_msec] = "time_msec",
+	[SYS_tx_data] = "tx_data",
+	[SYS_rx_data] = "rx_data",
+	[SYS_sleep_until] = "sleep_until",
+	[SYS_prof] = "prof",
+	[SYS_stats] = "stats",
+	[SYS_tx_batch] = "tx_batch",
+	[SYS_rx_batch] = "rx_batch",
+	[SYS_tx_wait] = "tx_wait",
+	[SYS_rx_bind] = "rx_bind",
+	[SYS_nic_map] = "nic_map",
+	[SYS_nic_kick] = "nic_kick",
+};
+
+static struct SysStat stats[NSYSCALLS];
+
+static void
+usage(void)
+{
+	printf("usage: sysstat [-r] [envid]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t envid = SYSSTAT_GLOBAL;
+	int i, b, r, reset = 0;
+	struct Argstate args;
+
+	argstart(&argc, argv, &args);
+	while ((i = argnext(&args)) >= 0)
+		switch (i) {
+		case 'r':
+			reset = 1;
+			break;
+		default:
+			usage();
+		}
+	if (argc > 2)
+		usage();
+	if (argc == 2)
+		envid = strtol(argv[1], 0, 16);
+
+	if ((r = sys_stats(envid, stats, reset)) < 0)
+		panic("sys_stats: %e", r);
+
+	printf("%-24s %10s %12s  histogram\n", "syscall", "calls", "avg cycles");
+	for (i = 0; i < NSYSCALLS; i++) {
+		if (!stats[i].ss_count)
+			continue;
+		printf("%-24s %10u %12u ", names[i] ? names[i] : "?",
+		       stats[i].ss_count,
+		       (uint32_t) (stats[i].ss_cycles / stats[i].ss_count));
+		for (b = 0; b < SYSSTAT_NBUCKETS; b++)
+			if (stats[i].ss_hist[b])
+				printf(" 2^%d:%u", b, stats[i].ss_hist[b]);
+		printf("\n");
+	}
+}
@@ -0,0 +1,77 @@
+// Test lazy FPU/SSE switching: several environments keep values in
+// %xmm0 and on the x87 stack across context switches, and a forked
+// child inherits its parent's SSE registers, which copy-on-write faults
+// leave alone.
+
+#include <inc/lib.h>
+
+#define NCHILD	4
+
+// Written only after fork, so that each write takes a copy-on-write fault
+static char cow[PGSIZE] __attribute__((aligned(PGSIZE)));
+
+// No clobber: user code is built without SSE, so the compiler never
+// uses %xmm0 itself.
+static void
+set_xmm0(uint32_t v)
+{
+	asm volatile("movd %0, %%xmm0; pshufd $0, %%xmm0, %%xmm0"
+		     : : "r" (v));
+}
+
+static uint32_t
+get_xmm0(int lane)
+{
+	uint32_t v[4] __attribute__((aligned(16)));
+
+	asm volatile("movdqa %%xmm0, %0" : "=m" (v));
+	return v[lane];
+}
+
+static void
+check(uint32_t v, int x87)
+{
+	int lane, got;
+
+	for (lane = 0; lane < 4; lane++)
+		if (get_xmm0(lane) != v)
+			panic("xmm0[%d] = %08x, want %08x", lane, get_xmm0(lane), v);
+	if (x87) {
+		asm volatile("fistl %0" : "=m" (got));
+		if (got != (int) v)
+			panic("st(0) = %d, want %d", got, v);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	int i, j, v;
+	envid_t child[NCHILD];
+
+	set_xmm0(0xcafef00d);
+	for (i = 0; i < NCHILD; i++) {
+		if ((child[i] = fork()) < 0)
+			panic("fork: %e", child[i]);
+		if (child[i] == 0) {
+			check(0xcafef00d, 0);
+			v = 1000 + i;
+			set_xmm0(v);
+			asm volatile("fildl %0" : : "m" (v));
+			cow[0] = i;
+			check(v, 1);
+			for (j = 0; j < 100; j++) {
+				sys_yield();
+				check(v, 1);
+			}
+			exit();
+		}
+	}
+	for (i = 0; i < NCHILD; i++)
+		wait(child[i]);
+	check(0xcafef00d, 0);
+	set_xmm0(0x600df00d);
+	cow[0] = 1;
+	check(0x600df00d, 0);
+	cprintf("testfpu ok\n");
+}
@@ -0,0 +1,39 @@
+// Test ipc_recv_until: it times out when nobody sends, not before its
+// deadline, and still receives what is sent in time.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	unsigned int deadline;
+	envid_t parent, who;
+	int32_t r;
+
+	// nobody sends
+	deadline = sys_time_msec() + 200;
+	if ((r = ipc_recv_until(&who, 0, 0, deadline)) != -E_TIMEOUT)
+		panic("ipc_recv_until returned %e, want %e", r, -E_TIMEOUT);
+	if (sys_time_msec() < deadline)
+		panic("ipc_recv_until timed out %u ms early",
+		      deadline - sys_time_msec());
+	assert(who == 0);
+	cprintf("ipc_recv_until timeout ok\n");
+
+	// a deadline already past times out too
+	if ((r = ipc_recv_until(&who, 0, 0, deadline - 100)) != -E_TIMEOUT)
+		panic("past deadline: ipc_recv_until returned %e", r);
+
+	// a child sends well before the deadline
+	parent = thisenv->env_id;
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		ipc_send(parent, 0x1234, 0, 0);
+		exit();
+	}
+	if ((r = ipc_recv_until(&who, 0, 0, sys_time_msec() + 5000)) != 0x1234)
+		panic("ipc_recv_until returned %e, want 0x1234", r);
+	cprintf("ipc_recv_until receive ok\n");
+	cprintf("testipctimeout ok\n");
+}
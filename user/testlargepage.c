@@ -0,0 +1,60 @@
+// Test 4MB (PTE_PS) pages: allocation, copy-on-write fork, 4K sub-page
+// mapping and unmapping.
+
+#include <inc/lib.h>
+
+#define VA	((char *) 0xA0000000)
+#define VA2	((char *) 0xA0800000)
+
+void
+umain(int argc, char **argv)
+{
+	int r, i;
+	envid_t child;
+
+	if ((r = sys_page_alloc(0, VA + PGSIZE, PTE_P|PTE_U|PTE_W|PTE_PS)) != -E_INVAL)
+		panic("misaligned 4MB sys_page_alloc: %e", r);
+	if ((r = sys_page_alloc(0, VA, PTE_P|PTE_U|PTE_W|PTE_PS)) < 0)
+		panic("sys_page_alloc: %e", r);
+	assert(uvpd[PDX(VA)] & PTE_PS);
+
+	// the page is zeroed and writable end to end
+	for (i = 0; i < PTSIZE; i += PGSIZE)
+		assert(VA[i] == 0 && VA[i + PGSIZE - 1] == 0);
+	VA[0] = 1;
+	VA[PTSIZE - 1] = 2;
+
+	// a 4K page inside it can be mapped on its own
+	if ((r = sys_page_map(0, VA + 5 * PGSIZE, 0, VA2, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_map: %e", r);
+	VA2[7] = 3;
+	assert(VA[5 * PGSIZE + 7] == 3);
+	assert(pageref(VA + 5 * PGSIZE) == 2);
+	assert(pageref(VA + 6 * PGSIZE) == 1);
+	sys_page_unmap(0, VA2);
+	cprintf("4K mapping of a 4MB page ok\n");
+
+	// fork gives the child its own copy of the 4MB page
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		assert(VA[0] == 1 && VA[PTSIZE - 1] == 2);
+		VA[PTSIZE / 2] = 4;
+		assert(uvpd[PDX(VA)] & PTE_PS);
+		assert(VA[PTSIZE / 2] == 4 && VA[PTSIZE - 1] == 2);
+		exit();
+	}
+	wait(child);
+	assert(VA[PTSIZE / 2] == 0);
+	assert(VA[0] == 1 && VA[PTSIZE - 1] == 2);
+	VA[1] = 5;
+	assert(uvpd[PDX(VA)] & PTE_PS);
+	assert(VA[1] == 5 && VA[PTSIZE - 1] == 2);
+	cprintf("fork copies 4MB pages ok\n");
+
+	// unmapping any address unmaps the whole 4MB page
+	if ((r = sys_page_unmap(0, VA + 3 * PGSIZE)) < 0)
+		panic("sys_page_unmap: %e", r);
+	assert(!(uvpd[PDX(VA)] & PTE_P));
+	cprintf("testlargepage ok\n");
+}
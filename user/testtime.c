@@ -12,8 +12,9 @@ sleep(int sec)
 	if (end < now)
 		panic("sleep: wrap");
 
-	while (sys_time_msec() < end)
-		sys_yield();
+	sys_sleep_until(end);
+	if (sys_time_msec() < end)
+		panic("sleep: woke up early");
 }
 
 void
@@ -0,0 +1,116 @@
+// Print the kernel event trace, one line per record:
+//	trace <cpu> <tsc> <event> <envid> <arg0> <arg1>
+// Without -f, prints what the rings hold and exits.  With -f, keeps
+// streaming new records, stopping after -n of them if given.  Redirect
+// the output to a file to keep it on disk.
+
+#include <inc/lib.h>
+#include <inc/trace.h>
+
+static const char * const event_names[NTRACE] = {
+	[TRACE_NONE] = "none",
+	[TRACE_ENV_RUN] = "env_run",
+	[TRACE_TRAP] = "trap",
+	[TRACE_IPC_SEND] = "ipc_send",
+	[TRACE_IPC_RECV] = "ipc_recv",
+	[TRACE_RX_PKT] = "rx_pkt",
+	[TRACE_TX_PKT] = "tx_pkt",
+	[TRACE_PGFLT] = "pgflt",
+	[TRACE_NIC_IRQ] = "nic_irq",
+};
+
+// Rings that fit in the trace area; only the ones for existing CPUs
+// are mapped.
+#define MAXCPU	((UENVS + PTSIZE - UTRACE) / TRACE_BUFSIZE)
+
+static struct TraceRec copy[TRACE_NRECS];
+
+static const volatile struct TraceBuf *
+tracebuf(int cpu)
+{
+	uintptr_t va = UTRACE + cpu * TRACE_BUFSIZE;
+
+	if (cpu >= MAXCPU || !(uvpd[PDX(va)] & PTE_P)
+	    || !(uvpt[PGNUM(va)] & PTE_P))
+		return NULL;
+	return (const volatile struct TraceBuf *) va;
+}
+
+// Print the records of 'tb' from index '*next' on, and advance '*next'.
+// Returns the number of records consumed; '*lost' counts the ones that
+// were overwritten before we got to them.
+static int
+drain(const volatile struct TraceBuf *tb, uint32_t *next, uint32_t *lost)
+{
+	uint32_t head, i, n;
+	const struct TraceRec *r;
+
+	head = tb->tb_head;
+	if (head - *next > TRACE_NRECS) {
+		*lost += head - *next - TRACE_NRECS;
+		*next = head - TRACE_NRECS;
+	}
+	n = head - *next;
+	for (i = 0; i < n; i++)
+		copy[i] = tb->tb_recs[(*next + i) & (TRACE_NRECS - 1)];
+
+	// Records the kernel may have overwritten while we copied
+	i = 0;
+	if (tb->tb_head - *next > TRACE_NRECS) {
+		i = tb->tb_head - *next - TRACE_NRECS;
+		if (i > n)
+			i = n;
+		*lost += i;
+	}
+	for (; i < n; i++) {
+		r = &copy[i];
+		printf("trace %d %08x%08x %s %08x %08x %08x\n", tb->tb_cpu,
+		       (uint32_t) (r->tr_tsc >> 32), (uint32_t) r->tr_tsc,
+		       r->tr_event < NTRACE ? event_names[r->tr_event] : "?",
+		       r->tr_envid, r->tr_arg[0], r->tr_arg[1]);
+	}
+	*next = head;
+	return n;
+}
+
+static void
+usage(void)
+{
+	printf("usage: tracedump [-f] [-n count]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	const volatile struct TraceBuf *tb;
+	uint32_t next[MAXCPU], lost = 0;
+	int i, ch, follow = 0, limit = 0, total = 0;
+	struct Argstate args;
+
+	argstart(&argc, argv, &args);
+	while ((ch = argnext(&args)) >= 0)
+		switch (ch) {
+		case 'f':
+			follow = 1;
+			break;
+		case 'n':
+			limit = strtol(argvalue(&args), 0, 0);
+			break;
+		default:
+			usage();
+		}
+
+	for (i = 0; i < MAXCPU && (tb = tracebuf(i)); i++)
+		next[i] = tb->tb_head > TRACE_NRECS ? tb->tb_head - TRACE_NRECS : 0;
+
+	do {
+		for (i = 0; i < MAXCPU && (tb = tracebuf(i)); i++)
+			total += drain(tb, &next[i], &lost);
+		if (follow)
+			sys_yield();
+	} while (follow && (!limit || total < limit));
+
+	if (lost)
+		printf("tracedump: lost %u records\n", lost);
+}
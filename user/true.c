@@ -0,0 +1,7 @@
+// Exit at once; bench times spawn with it.
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+}